@@ -17,19 +17,19 @@
 #include "include/protein.h"
 #include "include/skeleton_overall.h"
 #include "include/MRC.h"
+#include "include/components.h"
+#include "include/mapstream.h"
 #include "include/axis.h"
+#include "include/matching.h"
 
 #define SSTR( x ) dynamic_cast< std::ostringstream & >(( std::ostringstream() << std::dec << x ) ).str()
 
 using namespace std;
 using Eigen::MatrixXd;
-int regionQuery(int tempGroup[], int pointPlace, Map mrc, int groupNum, bool visited[], double threshold);
-int regionQueryIt(int tempGroup[], int pointPlace, Map mrc, int groupNum, bool visited[], int groupCurrent[], int &num, bool notVisited[], double threshold);
-int expandGroup(int tempGroup[], bool visited[], Map mrc, int groupCurrent[], int num, int groupNumber, bool notVisited[], double threshold);
-void linearFit(Map mrc, int tempGroup[], int groupNumber, int total[], string path, double stepSize, bool one, int &currHel, Protein pdb, int helixOffset, int numSplit, vector<int>groupToSplitArr, bool acute);
-void outputPoints(Map mrc, string path, double threshold);
+void linearFit(const Map &mrc, const GroupVoxels &groups, string path, double stepSize, bool one, int &currHel, Protein pdb, int helixOffset, int numSplit, vector<int>groupToSplitArr, bool acute, ThreadPool &pool);
+void outputPoints(const Map &mrc, string path, double threshold);
+Coordinate voxelPoint(const Map &mrc, size_t n);
 
-int returnedNum = 0;
 ofstream out;
 vector<Axis> helTraceArray;
 
@@ -53,7 +53,6 @@ int main(int argc, char *argv[])  {
     bool noSheet = false;
     bool touched = false;
     bool mrcBool = false;
-    int num = 0;
     ifstream inFile7;
     string pdbormrc;
     Map mrc;
@@ -64,6 +63,11 @@ int main(int argc, char *argv[])  {
     int number_of_hel;
     double stepSize;
     stepSize = 0.1;
+    int numThreads = defaultThreadCount();
+    bool optimalAssignment = false;     // --assign hungarian: one-to-one min-cost matching instead of the greedy pass
+    Connectivity connectivity = CONNECT_26;     // --connectivity: which neighbours join map voxels into a group
+    int slabDepth = 0;                          // --stream: slices per slab read from the map, 0 loads it whole
+    bool smoothMap = false;                     // --smooth: gaussian smoothing of the map before grouping
     vector<Axis> helTrueArray;
     vector<Axis> acuteHelix;
     vector<Axis> acuteSplitHelices;
@@ -85,8 +89,61 @@ int main(int argc, char *argv[])  {
     bool n = false;
 ofstream outCoordinates100;
 
+    ///optional settings after the four file arguments
+    bool validArgs = (argc >= 5);
+    for(int a = 5; a < argc && validArgs; a++)
+    {
+        option = argv[a];
+        if(option == "--assign" && a+1 < argc)
+        {
+            option = argv[++a];
+            if(option == "hungarian")
+                optimalAssignment = true;
+            else if(option == "greedy")
+                optimalAssignment = false;
+            else
+                validArgs = false;
+        }
+        else if(option == "--connectivity" && a+1 < argc)
+        {
+            int c = atoi(argv[++a]);
+            validArgs = (c == 6 || c == 18 || c == 26);
+            connectivity = Connectivity(c);
+        }
+        else if(option == "--stream" && a+1 < argc)
+        {
+            slabDepth = atoi(argv[++a]);
+            validArgs = (slabDepth >= 1);
+        }
+        else if(option == "--smooth")
+            smoothMap = true;
+        else if(option == "--threads" && a+1 < argc)
+        {
+            numThreads = atoi(argv[++a]);
+            validArgs = (numThreads >= 1);
+        }
+        else if(option == "--log-level" && a+1 < argc)
+        {
+            int level;
+            validArgs = Logger::parseLevel(argv[++a], level);
+            if(validArgs)
+                Logger::setLevel(level);
+        }
+        else if(option == "--log-category" && a+1 < argc)
+        {
+            int mask;
+            validArgs = Logger::parseCategories(argv[++a], mask);
+            if(validArgs)
+                Logger::setCategories(mask);
+        }
+        else
+            validArgs = false;
+    }
+
+    ThreadPool pool(numThreads);
+
     ///open files and separate if necessary
-    if(argc == 5)
+    if(validArgs)
     {
         pdbFileName = argv[1]; //"C:/Users/paulh/Desktop/DeskTop-5-18/Research/1FLP/1FLP";
         int longNameOffset = 1;
@@ -108,10 +165,25 @@ ofstream outCoordinates100;
             helBaseName = tempera.substr(0, tempera.length()-2);
             helEndName = tempera.substr(tempera.length()-2+1,tempera.length()-(tempera.length()-2+1));
             mrcBool = true;
-            mrc.read( tempera + ".mrc");
-            //mrc.printInfo();
-            mrc.normalize();
-            mrc.filterize(float(.0001/mrc.hdr.amax));
+            mrcFileName = tempera + ".mrc";
+            if(slabDepth > 0)
+            {
+                ///streamed, the voxels are read again slab by slab when they are grouped; only the header is kept
+                MapStream stream(mrcFileName, slabDepth);
+                mrc.hdr = stream.hdr;
+                mrc.apixX = stream.apixX;
+                mrc.apixY = stream.apixY;
+                mrc.apixZ = stream.apixZ;
+            }
+            else
+            {
+                mrc.read(mrcFileName);
+                //mrc.printInfo();
+                ///normalize and filterize in one pass
+                mrc.process(VoxelPipeline().divide(mrc.hdr.amax).filter(float(.0001/mrc.hdr.amax)), pool);
+                if(smoothMap)
+                    mrc.gauss_smooth(pool, SeparableFilter(gaussWeights, 7));
+            }
             //mrc.buildGradient(0);
             //mrc.buildTensor();
             //mrc.buildThickness(0);
@@ -470,8 +542,14 @@ ofstream outCoordinates100;
     }
     else
     {
-        cout<<"usage: "<< argv[0] <<" trueStructureFileLocation "<<" DetectedHelixFileLocation"<<" DetectedStickFileLocation "<< " LocationToCreateOutputFile "<<endl; //argv[0] is the program name
+        cout<<"usage: "<< argv[0] <<" trueStructureFileLocation "<<" DetectedHelixFileLocation"<<" DetectedStickFileLocation "<< " LocationToCreateOutputFile "<< " [--assign greedy|hungarian] [--connectivity 6|18|26] [--stream N] [--smooth] [--threads N] [--log-level none|error|warn|info|debug|trace] [--log-category general,matching,displacement,map]" <<endl; //argv[0] is the program name
         cout<< "Only trueStructureFileLocation is required. Replace argument with 'Empty' if not using it." << endl;
+        cout<< "--assign hungarian matches true and detected SSEs one-to-one by minimum total displacement (default: greedy)." << endl;
+        cout<< "--connectivity sets whether map voxels sharing a face, an edge or a corner touch (default: 26)." << endl;
+        cout<< "--stream reads a map N slices at a time while it is preprocessed and grouped, instead of loading it whole." << endl;
+        cout<< "--smooth gauss smooths a map before its voxels are grouped." << endl;
+        cout<< "--threads sets how many cores compare true and detected SSEs (default: all of them)." << endl;
+        cout<< "--log-level sets how much diagnostic output goes to stderr (default: warn)." << endl;
         exit(1);
     }
 
@@ -705,175 +783,93 @@ ofstream outCoordinates100;
         {
             cout << "Grouping voxels ..." << endl;
 
-            ///grouping voxels into groups that touch each other
-            int *tempGroup;
-            tempGroup = (int *)malloc(sizeof(int)*(mrc.numSlcs()*mrc.numCols()*mrc.numRows()));
-            bool *visited;
-            visited = (bool *)malloc(sizeof(bool)*(mrc.numSlcs()*mrc.numCols()*mrc.numRows()));
-            bool *notVisited;
-            notVisited = (bool *)malloc(sizeof(bool)*(mrc.numSlcs()*mrc.numCols()*mrc.numRows()));
-            //bool notVisited[mrc.numSlcs()*mrc.numCols()*mrc.numRows()];
-            int *groupCurrent;
-            groupCurrent = (int *)malloc(sizeof(int)*(10000));
-            int total[500];
-
-            for(int i = 0; i < mrc.numSlcs()*mrc.numCols()*mrc.numRows(); i++)
+            double threshold = .72/mrc.hdr.amax;
+
+            ///grouping voxels into groups that touch each other, single voxels are left out
+            ///groups are numbered on from the ones of the chains before
+            int firstGroup = groupNumber;
+            GroupVoxels groups(firstGroup);
+            if(slabDepth > 0)
             {
-                if(i < 500)
-                    total[i] = 0;
-                if(i < 10000)
-                    groupCurrent[i] = -1;
-                tempGroup[i] = -1;
-                visited[i] = false;
-                notVisited[i] = false;
+                ///the same steps as on the whole map while the slabs stream past, finished groups are handed on slab by slab
+                MapStream stream(mrcFileName, slabDepth);
+                stream.normalize();
+                stream.filterize(float(.0001/stream.hdr.amax));
+                if(smoothMap)
+                {
+                    ///gauss_smooth() sets the header to the smoothed densities, so find their maximum first
+                    stream.gauss_smooth();
+                    stream.forEachSlab(0, [](const MapSlab&) {});
+                    threshold = .72/stream.amax;
+                }
+                SlabComponents components(threshold, [&](const vector<size_t> &voxels) {groups.add(voxels);}, 2, connectivity);
+                stream.forEachSlab(0, [&](const MapSlab &slab) {components.add(slab);});
+                components.finish();
+                groups.sortByFirstVoxel(firstGroup);
             }
-            ///recursive method
-            /*
-            int numReturned = -1;
-            for (long k=0; k<mrc.numSlcs(); k++)
-                for (long j=0; j<mrc.numCols(); j++)
-                    for (long i=0; i<mrc.numRows(); i++)
-                    {
-                        if (mrc.cube[i][j][k]>0 && visited[(k*mrc.numCols()*mrc.numRows()+j*mrc.numRows()+i)] == false)
-                        {
-                            numReturned = regionQuery(tempGroup,(k*mrc.numCols()*mrc.numRows()+j*mrc.numRows()+i), mrc, groupNumber, visited);
-                            cout << numReturned << " ";
-                            groupNumber++;
-                            returnedNum = 0;
-                        }
-                    }
-                    cout << "\n\n";
-            */
-            ///figure out the values of cube[][][]
-            double low = 1;
-            double high = 0;
-            double temp = 0;
-            double middle = 0;
-            int iter = 0;
-            for (long k=0; k<mrc.numSlcs(); k++)
-                for (long j=0; j<mrc.numCols(); j++)
-                    for (long i=0; i<mrc.numRows(); i++)
-                    {
-                        temp = mrc.cube[i][j][k];
-                        if(temp != 0)
-                        {
-                            if(temp < low)
-                                low = temp;
-                            if(temp > high)
-                                high = temp;
-                        }
-                    }
-            middle = (high-low)/2;
-            middle += low;
-
-            int tempJ = 0;
-            int tempK = 0;
-            int tempI = 0;
-            double threshold = .72/mrc.hdr.amax;//middle;
-
-            ///iterative method
-            int numReturned = -1;
-            int groupSize = 0;
-            for (long k=0; k<mrc.numSlcs(); k++)
-                for (long j=0; j<mrc.numCols(); j++)
-                    for (long i=0; i<mrc.numRows(); i++)
-                    {
-                        //cout << k << endl;
-                        if (mrc.cube[i][j][k]> threshold && visited[(k*mrc.numCols()*mrc.numRows()+j*mrc.numRows()+i)] == false)
-                        {
-                            numReturned = regionQueryIt(tempGroup,(k*mrc.numCols()*mrc.numRows()+j*mrc.numRows()+i), mrc, groupNumber, visited, groupCurrent, num, notVisited, threshold);
-                            ///if numReturned is too small, delete it TODO
-                            groupSize = expandGroup(tempGroup, visited, mrc, groupCurrent, numReturned, groupNumber, notVisited, threshold);
-                            for(int y = 0; y < 10000; y++)
-                            {
-                                if(groupCurrent[y] == -1)
-                                {
-                                    y = 10000;
-                                }
-                                else
-                                {
-                                    total[groupNumber]++;
-                                    tempGroup[groupCurrent[y]] = groupNumber;
-                                    groupCurrent[y] = -1;
-                                }
-
-                            }
-                            if(groupSize != 0)
-                                groupNumber++;
-                            returnedNum = 0;
-                            num = 0;
-                            //cout << "YYYYYYYYESSSSSSSSSSSSS" << endl;
-                        }
-                    }
+            else
+            {
+                VoxelComponents components(threshold, connectivity);
+                components.add(mrc.cube);
+                components.finish(2);
+                groups = GroupVoxels(components, firstGroup);
+            }
+            groupNumber = groups.count();
             //cout << groupNumber << endl;
             ///split group according to acute helices
             //find which from to split from true line
             if(acute == true)
             {
-                for(int z = 0; z < numSplit; z++)
+                ///grouped voxels in scan order with their group, the tree finds the closest one to every acute helix
+                vector<pair<size_t, int> > grouped;
+                for(int g = firstGroup; g < groupNumber; g++)
+                    for(int n = 0; n < groups.size(g); n++)
+                        grouped.push_back(make_pair(groups.voxel(g, n), g));
+                sort(grouped.begin(), grouped.end());
+                vector<size_t> voxelIndex(grouped.size());
+                vector<Coordinate> voxelPoints(grouped.size());
+                vector<int> voxelGroup(grouped.size());
+                for(size_t n = 0; n < grouped.size(); n++)
                 {
+                    voxelIndex[n] = grouped[n].first;
+                    voxelPoints[n] = voxelPoint(mrc, grouped[n].first);
+                    voxelGroup[n] = grouped[n].second;
+                }
+                KDTree voxelTree;
+                voxelTree.build(voxelPoints);
 
-                    double distance = 0;
-                    double smallestDist = 99999999;
-                    int correspondingGroup = 0;
+                for(int z = 0; z < numSplit; z++)
+                {
                     double cubeX = 0;
                     double cubeY = 0;
                     double cubeZ = 0;
-                    int groupToSplit = -2;
-                    Coordinate point = acuteHelix[z].firstPoint();
-                    for (long k=0; k<mrc.numSlcs(); k++)
-                        for (long j=0; j<mrc.numCols(); j++)
-                            for (long i=0; i<mrc.numRows(); i++)
-                            {
-                                if(mrc.cube[i][j][k] > threshold)
-                                {
-                                    cubeX = i*mrc.apixX+mrc.hdr.xorigin;
-                                    cubeY = j*mrc.apixY+mrc.hdr.yorigin;
-                                    cubeZ = k*mrc.apixZ+mrc.hdr.zorigin;
-                                    distance = sqrt(pow((point.x-cubeX),2)+pow((point.y-cubeY),2)+pow((point.z-cubeZ),2));
-
-                                    if(distance < smallestDist)
-                                    {
-                                        smallestDist = distance;
-                                        correspondingGroup = k*mrc.numCols()*mrc.numRows()+j*mrc.numRows()+i;
-                                    }
-                                }
-                            }
-                    groupToSplit = tempGroup[correspondingGroup];
-                    groupToSplitArr.push_back(tempGroup[correspondingGroup]);
-                    //cout << groupToSplit << " " << total[groupNumber] << endl;
-
-                    //split group
-                    double firstDist = 0;
-                    double secondDist = 0;
+                    ///closest grouped voxel, the first in scan order on a tie
+                    double distanceSq = 0;
+                    int closest = voxelTree.nearest(acuteHelix[z].firstPoint(), distanceSq);
+                    int groupToSplit = closest < 0 ? -1 : voxelGroup[closest];
+                    groupToSplitArr.push_back(groupToSplit);
+                    //cout << groupToSplit << " " << groups.size(groupToSplit) << endl;
+
+                    //split group, the voxels closer to the second helix go to a new group
                     Coordinate firstPoint = acuteSplitHelices[0+z*2].lastPoint();
                     Coordinate secondPoint = acuteSplitHelices[1+z*2].lastPoint();
-                    for (long k=0; k<mrc.numSlcs(); k++)
-                            for (long j=0; j<mrc.numCols(); j++)
-                                for (long i=0; i<mrc.numRows(); i++)
-                                {
-                                    //if this is the group to split compare distance of point to regroup
-                                    if(tempGroup[(k*mrc.numCols()*mrc.numRows()+j*mrc.numRows()+i)] == groupToSplit)
-                                    {
-                                        cubeX = i*mrc.apixX+mrc.hdr.xorigin;
-                                        cubeY = j*mrc.apixY+mrc.hdr.yorigin;
-                                        cubeZ = k*mrc.apixZ+mrc.hdr.zorigin;
-                                        firstDist = sqrt(pow((firstPoint.x-cubeX),2)+pow((firstPoint.y-cubeY),2)+pow((firstPoint.z-cubeZ),2));
-                                        secondDist = sqrt(pow((secondPoint.x-cubeX),2)+pow((secondPoint.y-cubeY),2)+pow((secondPoint.z-cubeZ),2));
-
-                                        if(secondDist < firstDist)
-                                        {
-                                            tempGroup[(k*mrc.numCols()*mrc.numRows()+j*mrc.numRows()+i)] = groupNumber;
-                                            total[groupToSplit]--;
-                                            total[groupNumber]++;
-                                        }
-                                    }
-                                }
-                                groupNumber++;
+                    int split = groups.split(groupToSplit, [&](size_t v)
+                    {
+                        Coordinate c = voxelPoint(mrc, v);
+                        cubeX = c.x;
+                        cubeY = c.y;
+                        cubeZ = c.z;
+                        double firstDist = sqrt(pow((firstPoint.x-cubeX),2)+pow((firstPoint.y-cubeY),2)+pow((firstPoint.z-cubeZ),2));
+                        double secondDist = sqrt(pow((secondPoint.x-cubeX),2)+pow((secondPoint.y-cubeY),2)+pow((secondPoint.z-cubeZ),2));
+                        return secondDist < firstDist;
+                    });
+                    for(int n = 0; n < groups.size(split); n++)
+                        voxelGroup[lower_bound(voxelIndex.begin(), voxelIndex.end(), groups.voxel(split, n)) - voxelIndex.begin()] = split;
+                    groupNumber++;
                 }
             }
             //outputPoints(mrc, path, 46);
-            linearFit(mrc, tempGroup, groupNumber, total, path, stepSize, one, currHel, pdb, helixOffset, numSplit, groupToSplitArr, acute);
+            linearFit(mrc, groups, path, stepSize, one, currHel, pdb, helixOffset, numSplit, groupToSplitArr, acute, pool);
         }
         //end of mrc stuff
 
@@ -935,7 +931,7 @@ ofstream outCoordinates100;
     // END OF INPUT
 
 
-cerr << "Beginning matching." << endl;
+LOG_INFO(LOG_MATCHING, "Beginning matching.");
 
 int matchedAlternate[helixOffset + strandOffset];
 double AlternateLateral[helixOffset + strandOffset];
@@ -979,6 +975,22 @@ Displacement Dis;
     comparedDistance = 9;
  else
     comparedDistance = 15;
+
+ // every pair the matching below can look at is evaluated once, in parallel, up front
+ DisplacementMatrix displacements(&helTrueArray, &helTraceArray, stepSize);
+ DisplacementMatrix splitDisplacements(&acuteSplitHelices, &helTraceArray, stepSize);
+ for (int currTrueHel = 0; currTrueHel < helixOffset + strandOffset; currTrueHel++)
+ {
+     trueCenter = axisCenter(helTrueArray[currTrueHel]);
+     for (int currTraceHel = 0; currTraceHel < number_of_hel; currTraceHel++)
+         if (getDistance(trueCenter, axisCenter(helTraceArray[currTraceHel])) < comparedDistance)
+             displacements.addPair(currTrueHel, currTraceHel);
+ }
+ for (int split = 0; split < splitNum.size(); split++)
+     for (int currTraceHel = 0; currTraceHel < number_of_hel; currTraceHel++)
+         splitDisplacements.addPair(2*split+1, currTraceHel);
+ displacements.evaluate(pool);
+ splitDisplacements.evaluate(pool);
  //if(tempera == "Empty")
  //{
  //    holder = helixOffset;
@@ -986,19 +998,15 @@ Displacement Dis;
                     //= holder
  for (int currTrueHel = 0; currTrueHel < helixOffset + strandOffset; currTrueHel++) //for each true helix position
  {
-    trueCenter.x = (helTrueArray[currTrueHel].axisPoints[0].x + helTrueArray[currTrueHel].axisPoints[helTrueArray[currTrueHel].axisPoints.size()-1].x)/2;
-    trueCenter.y = (helTrueArray[currTrueHel].axisPoints[0].y + helTrueArray[currTrueHel].axisPoints[helTrueArray[currTrueHel].axisPoints.size()-1].y)/2;
-    trueCenter.z = (helTrueArray[currTrueHel].axisPoints[0].z + helTrueArray[currTrueHel].axisPoints[helTrueArray[currTrueHel].axisPoints.size()-1].z)/2;
-    cerr <<endl << "True center: " << trueCenter.x << " " << trueCenter.y << " " << trueCenter.z << endl;
+    trueCenter = axisCenter(helTrueArray[currTrueHel]);
+    LOG_DEBUG(LOG_MATCHING, "True center: " << trueCenter.x << " " << trueCenter.y << " " << trueCenter.z);
 
     SecondDist = 99999;
      minDist = 3.0;
      for (int currTraceHel = 0; currTraceHel < number_of_hel; currTraceHel++) // check each trace for nearness
      {
-         cerr << "Comparing trace " << currTraceHel << endl;
-         traceCenter.x = (helTraceArray[currTraceHel].axisPoints[0].x + helTraceArray[currTraceHel].axisPoints[helTraceArray[currTraceHel].axisPoints.size()-1].x)/2;
-         traceCenter.y = (helTraceArray[currTraceHel].axisPoints[0].y + helTraceArray[currTraceHel].axisPoints[helTraceArray[currTraceHel].axisPoints.size()-1].y)/2;
-         traceCenter.z = (helTraceArray[currTraceHel].axisPoints[0].z + helTraceArray[currTraceHel].axisPoints[helTraceArray[currTraceHel].axisPoints.size()-1].z)/2;
+         LOG_TRACE(LOG_MATCHING, "Comparing trace " << currTraceHel);
+         traceCenter = axisCenter(helTraceArray[currTraceHel]);
         distCent = getDistance(trueCenter, traceCenter);
 
         if(shortHelix[currTrueHel] == true && distCent < minDist)
@@ -1013,8 +1021,7 @@ Displacement Dis;
         else if((distCent < comparedDistance))
         {
 
-             helTrueArray[currTrueHel].alignDirectionHels(&helTraceArray[currTraceHel]);
-             Dis = helTrueArray[currTrueHel].findDisplacement(&helTraceArray[currTraceHel], stepSize);
+             Dis = displacements.get(currTrueHel, currTraceHel);
              distCent = Dis.crossDisplace;
              minLong = Dis.longDisplace;
              if (distCent < minDist)
@@ -1042,8 +1049,7 @@ Displacement Dis;
             //acuteSplitHelices[itOdd].printAsPnts(outputFilename);
             //outputFilename = path + "output/TEST2.pdb";
             //helTraceArray[currTraceHel].printAsPnts(outputFilename);
-            acuteSplitHelices[itOdd].alignDirectionHels(&helTraceArray[currTraceHel]);
-            Dis2 =  acuteSplitHelices[itOdd].findDisplacement(&helTraceArray[currTraceHel], stepSize);
+            Dis2 = splitDisplacements.get(itOdd, currTraceHel);
             distCent2 = Dis2.crossDisplace;
 
             if(distCent2 < SecondDist)
@@ -1055,7 +1061,7 @@ Displacement Dis;
             }
 
         }
-         cerr << "Done comparing trace " << currTraceHel << endl;
+         LOG_TRACE(LOG_MATCHING, "Done comparing trace " << currTraceHel);
      }
      if(it < splitNum.size() && currTrueHel == splitNum[it])
      {
@@ -1063,18 +1069,31 @@ Displacement Dis;
          itOdd+=2;
      }
 
-     if (matchedHels[currTrueHel] == 99999)
+     if (matchedHels[currTrueHel] == 99999 && optimalAssignment == false)
      {
          cout << "There is no trace detected for true Helix/Sheet " << currTrueHel+1 << endl;
      }
 }
 
+if(optimalAssignment == true)
+{
+    assignOptimal(displacements, helTrueArray, helTraceArray, helixOffset + strandOffset, number_of_hel, shortHelix, comparedDistance,
+                  matchedHels, shortHels, matchedAlternate, AlternateLateral, AlternateLongitudinal);
+    for (int currTrueHel = 0; currTrueHel < helixOffset + strandOffset; currTrueHel++)
+        if (matchedHels[currTrueHel] == 99999)
+            cout << "There is no trace detected for true Helix/Sheet " << currTrueHel+1 << endl;
+}
+
 
 double score1 = 0;
 double score2 = 0;
 int newComparison = -1;
-//make sure that all strands are only matched once
-for(int i = 0; i < helixOffset + strandOffset; i++)
+int lostTrace = -1;
+// lostMatch[true*number_of_hel + trace] is set once that true SSE has lost that trace to another one,
+// so a loser is never handed back the trace it just lost and the restarts below always terminate
+vector<bool> lostMatch((helixOffset + strandOffset)*number_of_hel, false);
+//make sure that all strands are only matched once (the optimal assignment never matches a trace twice)
+for(int i = 0; i < helixOffset + strandOffset && optimalAssignment == false; i++)
 {
     //cout << matchedHels[i] << endl;
     for(int j = 0; j < helixOffset + strandOffset; j++)
@@ -1082,13 +1101,9 @@ for(int i = 0; i < helixOffset + strandOffset; i++)
         //cout << i << " " << j << " " << matchedHels[i] << " " << matchedHels[j] << endl;
         if(i != j && matchedHels[i] != 99999 && matchedHels[j] != 99999 && matchedHels[i] == matchedHels[j])
         {
-            helTrueArray[i].alignDirectionHels(&helTraceArray[matchedHels[i]]);
-            Dis = helTrueArray[i].findDisplacement(&helTraceArray[matchedHels[i]], stepSize);
-            score1 = Dis.crossDisplace;
-
-            helTrueArray[j].alignDirectionHels(&helTraceArray[matchedHels[j]]);
-            Dis = helTrueArray[j].findDisplacement(&helTraceArray[matchedHels[j]], stepSize);
-            score2 = Dis.crossDisplace;
+            lostTrace = matchedHels[i];
+            score1 = displacements.get(i, matchedHels[i]).crossDisplace;
+            score2 = displacements.get(j, matchedHels[j]).crossDisplace;
 
             if(score1 < score2)
             {
@@ -1100,22 +1115,20 @@ for(int i = 0; i < helixOffset + strandOffset; i++)
                 matchedHels[i] = 99999;
                 newComparison = i;
             }
+            lostMatch[newComparison*number_of_hel + lostTrace] = true;
 
+            trueCenter = axisCenter(helTrueArray[newComparison]);
             SecondDist = 99999;
              minDist = 3.0;
              for (int currTraceHel = 0; currTraceHel < number_of_hel; currTraceHel++) // check each trace for nearness
              {
-                 cerr << "Comparing trace " << currTraceHel << endl;
-                 traceCenter.x = (helTraceArray[currTraceHel].axisPoints[0].x + helTraceArray[currTraceHel].axisPoints[helTraceArray[currTraceHel].axisPoints.size()-1].x)/2;
-                 traceCenter.y = (helTraceArray[currTraceHel].axisPoints[0].y + helTraceArray[currTraceHel].axisPoints[helTraceArray[currTraceHel].axisPoints.size()-1].y)/2;
-                 traceCenter.z = (helTraceArray[currTraceHel].axisPoints[0].z + helTraceArray[currTraceHel].axisPoints[helTraceArray[currTraceHel].axisPoints.size()-1].z)/2;
+                 LOG_TRACE(LOG_MATCHING, "Comparing trace " << currTraceHel);
+                 traceCenter = axisCenter(helTraceArray[currTraceHel]);
                 distCent = getDistance(trueCenter, traceCenter);
 
-                if((distCent < comparedDistance))
+                if((distCent < comparedDistance) && lostMatch[newComparison*number_of_hel + currTraceHel] == false)
                 {
-
-                     helTrueArray[newComparison].alignDirectionHels(&helTraceArray[currTraceHel]);
-                     Dis = helTrueArray[newComparison].findDisplacement(&helTraceArray[currTraceHel], stepSize);
+                     Dis = displacements.get(newComparison, currTraceHel);
                      distCent = Dis.crossDisplace;
 
                      if (distCent < minDist)
@@ -1245,8 +1258,7 @@ for (int currentHel = 0; currentHel <  helixOffset + strandOffset; currentHel++)
             }
             else
             {
-               helTrueArray[currentHel].alignDirectionHels(&helTraceArray[matchedHels[currentHel]]);
-                displaced = helTrueArray[currentHel].findDisplacement(&helTraceArray[matchedHels[currentHel]], stepSize);
+                displaced = displacements.get(currentHel, matchedHels[currentHel]);
                 if(outExist == true)
                 {
                     outFile << currentHel+1 << ", " << matchedHels[currentHel]+1 << ", ";
@@ -1332,11 +1344,8 @@ for (int currentHel = 0; currentHel <  helixOffset + strandOffset; currentHel++)
     //for cases where trace helix is split and two trace helices need to be matched to a true helix
     if(matchedAlternate[currentHel] != 99999)
     {
-        helTrueArray[currentHel].alignDirectionHels(&helTraceArray[matchedAlternate[currentHel]]);
-        displaced = helTrueArray[currentHel].findDisplacement(&helTraceArray[matchedAlternate[currentHel]], stepSize);
-
-        helTrueArray[currentHel].alignDirectionHels(&helTraceArray[matchedHels[currentHel]]);
-        Dis3 = helTrueArray[currentHel].findDisplacement(&helTraceArray[matchedHels[currentHel]], stepSize);
+        displaced = displacements.get(currentHel, matchedAlternate[currentHel]);
+        Dis3 = displacements.get(currentHel, matchedHels[currentHel]);
         if(one == false)
         {
             if(currentHel < helixOffset)
@@ -1378,882 +1387,228 @@ if(outExist == true)
 return 0;
 }
 
-int regionQuery(int tempGroup[], int pointPlace, Map mrc, int groupNum, bool visited[], double threshold)
-{
-    int tempI = 0;
-    int tempJ = 0;
-    int tempK = 0;
-    int offset = 0;
-    tempK = pointPlace/(mrc.numCols()*mrc.numRows());
-    tempJ = (pointPlace-(tempK*mrc.numCols()*mrc.numRows()))/mrc.numRows();
-    tempI = (pointPlace-(tempK*mrc.numCols()*mrc.numRows())-(tempJ*mrc.numRows()));
-
-    //center point
-    tempGroup[pointPlace] = groupNum;
-    ///i
-    //first point
-    if(mrc.cube[tempI][tempJ+1][tempK] > threshold && visited[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI))] == false)
-    {
-        visited[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI))] = true;
-        tempGroup[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI)), mrc, groupNum, visited, threshold);
-    }
-    //second point
-    if(mrc.cube[tempI][tempJ+1][tempK-1] > threshold && visited[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI))] == false)
-    {
-        visited[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI))] = true;
-        tempGroup[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI)), mrc, groupNum, visited, threshold);
-    }
-    //third point
-    if(mrc.cube[tempI][tempJ+1][tempK+1] > threshold && visited[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI))] == false)
-    {
-        visited[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI))] = true;
-        tempGroup[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI)), mrc, groupNum, visited, threshold);
-    }
-    //fourth point
-    if(mrc.cube[tempI][tempJ-1][tempK] > threshold && visited[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI))] == false)
-    {
-        visited[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI))] = true;
-        tempGroup[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI)), mrc, groupNum, visited, threshold);
-    }
-    //fifth point
-    if(mrc.cube[tempI][tempJ-1][tempK-1] > threshold && visited[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI))] == false)
-    {
-        visited[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI))] = true;
-        tempGroup[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI)), mrc, groupNum, visited, threshold);
-    }
-    //sixth point
-    if(mrc.cube[tempI][tempJ-1][tempK+1] > threshold && visited[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI))] == false)
-    {
-        visited[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI))] = true;
-        tempGroup[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI)), mrc, groupNum, visited, threshold);
-    }
-    //seventh point
-    if(mrc.cube[tempI][tempJ][tempK-1] > threshold && visited[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI))] == false)
-    {
-        visited[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI))] = true;
-        tempGroup[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI)), mrc, groupNum, visited, threshold);
-    }
-    //eighth point
-    if(mrc.cube[tempI][tempJ][tempK+1] > threshold && visited[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI))] == false)
-    {
-        visited[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI))] = true;
-        tempGroup[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI)), mrc, groupNum, visited, threshold);
-    }
-    ///i+1
-    //first point
-    if(mrc.cube[tempI+1][tempJ+1][tempK] > threshold && visited[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI+1))] == false)
-    {
-        visited[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI+1))] = true;
-        tempGroup[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI+1))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI+1)), mrc, groupNum, visited, threshold);
-    }
-    //second point
-    if(mrc.cube[tempI+1][tempJ+1][tempK-1] > threshold && visited[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI+1))] == false)
-    {
-        visited[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI+1))] = true;
-        tempGroup[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI+1))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI+1)), mrc, groupNum, visited, threshold);
-    }
-    //third point
-    if(mrc.cube[tempI+1][tempJ+1][tempK+1] > threshold && visited[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI+1))] == false)
-    {
-        visited[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI+1))] = true;
-        tempGroup[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI+1))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI+1)), mrc, groupNum, visited, threshold);
-    }
-    //fourth point
-    if(mrc.cube[tempI+1][tempJ-1][tempK] > threshold && visited[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI+1))] == false)
-    {
-        visited[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI+1))] = true;
-        tempGroup[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI+1))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI+1)), mrc, groupNum, visited, threshold);
-    }
-    //fifth point
-    if(mrc.cube[tempI+1][tempJ-1][tempK-1] > threshold && visited[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI+1))] == false)
-    {
-        visited[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI+1))] = true;
-        tempGroup[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI+1))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI+1)), mrc, groupNum, visited, threshold);
-    }
-    //sixth point
-    if(mrc.cube[tempI+1][tempJ-1][tempK+1] > threshold && visited[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI+1))] == false)
-    {
-        visited[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI+1))] = true;
-        tempGroup[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI+1))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI+1)), mrc, groupNum, visited, threshold);
-    }
-    //seventh point
-    if(mrc.cube[tempI+1][tempJ][tempK-1] > threshold && visited[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI+1))] == false)
-    {
-        visited[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI+1))] = true;
-        tempGroup[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI+1))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI+1)), mrc, groupNum, visited, threshold);
-    }
-    //eighth point
-    if(mrc.cube[tempI+1][tempJ][tempK+1] > threshold && visited[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI+1))] == false)
-    {
-        visited[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI+1))] = true;
-        tempGroup[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI+1))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI+1)), mrc, groupNum, visited, threshold);
-    }
-    //ninth point
-    if(mrc.cube[tempI+1][tempJ][tempK] > threshold && visited[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI+1))] == false)
-    {
-        visited[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI+1))] = true;
-        tempGroup[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI+1))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI+1)), mrc, groupNum, visited, threshold);
-    }
-    ///i-1
-    //first point
-    if(mrc.cube[tempI-1][tempJ+1][tempK] > threshold && visited[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI-1))] == false)
-    {
-        visited[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI-1))] = true;
-        tempGroup[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI-1))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI-1)), mrc, groupNum, visited, threshold);
-    }
-    //second point
-    if(mrc.cube[tempI-1][tempJ+1][tempK-1] > threshold && visited[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI-1))] == false)
-    {
-        visited[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI-1))] = true;
-        tempGroup[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI-1))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI-1)), mrc, groupNum, visited, threshold);
-    }
-    //third point
-    if(mrc.cube[tempI-1][tempJ+1][tempK+1] > threshold && visited[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI-1))] == false)
-    {
-        visited[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI-1))] = true;
-        tempGroup[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI-1))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI-1)), mrc, groupNum, visited, threshold);
-    }
-    //fourth point
-    if(mrc.cube[tempI-1][tempJ-1][tempK] > threshold && visited[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI-1))] == false)
-    {
-        visited[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI-1))] = true;
-        tempGroup[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI-1))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI-1)), mrc, groupNum, visited, threshold);
-    }
-    //fifth point
-    if(mrc.cube[tempI-1][tempJ-1][tempK-1] > threshold && visited[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI-1))] == false)
-    {
-        visited[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI-1))] = true;
-        tempGroup[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI-1))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI-1)), mrc, groupNum, visited, threshold);
-    }
-    //sixth point
-    if(mrc.cube[tempI-1][tempJ-1][tempK+1] > threshold && visited[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI-1))] == false)
-    {
-        visited[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI-1))] = true;
-        tempGroup[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI-1))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI-1)), mrc, groupNum, visited, threshold);
-    }
-    //seventh point
-    if(mrc.cube[tempI-1][tempJ][tempK-1] > threshold && visited[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI-1))] == false)
-    {
-        visited[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI-1))] = true;
-        tempGroup[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI-1))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI-1)), mrc, groupNum, visited, threshold);
-    }
-    //eighth point
-    if(mrc.cube[tempI-1][tempJ][tempK+1] > threshold && visited[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI-1))] == false)
-    {
-        visited[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI-1))] = true;
-        tempGroup[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI-1))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI-1)), mrc, groupNum, visited, threshold);
-    }
-    //ninth point
-    if(mrc.cube[tempI-1][tempJ][tempK] > threshold && visited[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI-1))] == false)
-    {
-        visited[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI-1))] = true;
-        tempGroup[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI-1))] = groupNum;
-        returnedNum++;
-        regionQuery(tempGroup, ((tempK)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI-1)), mrc, groupNum, visited, threshold);
-    }
-
-
-    //for(int i = 0; i < 50; i++)
-    //    cout << tempGroup[i] << " ";
-    //cout << "\n\n";
+typedef Eigen::Matrix<float, Eigen::Dynamic, 3> PointMatrix;   //one point per row
 
-    return returnedNum;
-}
+// One group of voxels and the curve fitted through it
+struct GroupFit
+{
+    PointMatrix realPoints;
+    double mean[3];
+    double boxMin[3];       //box around the group and every group before it
+    double boxMax[3];
+    vector<Coordinate> helPoints;
+};
 
-int regionQueryIt(int tempGroup[], int pointPlace, Map mrc, int groupNum, bool visited[], int groupCurrent[], int &num, bool notVisited[], double threshold)
+///fit a line through a group, then a quadratic curve through its voxels taken at their positions along the line
+void fitGroup(GroupFit &fit, int x, string path)
 {
-    int returnedNum = 0;
-    int tempI = 0;
-    int tempJ = 0;
-    int tempK = 0;
-    int offset = 0;
-    tempK = pointPlace/(mrc.numCols()*mrc.numRows());
-    tempJ = (pointPlace-(tempK*mrc.numCols()*mrc.numRows()))/mrc.numRows();
-    tempI = (pointPlace-(tempK*mrc.numCols()*mrc.numRows())-(tempJ*mrc.numRows()));
-    int tempEq = 0;
-
-    //center point
-    //tempGroup[pointPlace] = groupNum;
-    ///i
-    //first point
-    if(tempI > 0 && tempJ+1 > 0 && tempK > 0 && tempI < mrc.numRows() && tempJ+1 < mrc.numCols() && tempK < mrc.numSlcs())
-    {
-        tempEq = ((tempK)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI));
-        if(notVisited[tempEq] == false && mrc.cube[tempI][tempJ+1][tempK] > threshold && visited[tempEq] == false )
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //second point
-    if(tempI > 0 && tempJ+1 > 0 && tempK-1 > 0 && tempI < mrc.numRows() && tempJ+1 < mrc.numCols() && tempK-1 < mrc.numSlcs())
-    {
-        tempEq = ((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI));
-        if( notVisited[tempEq] == false && mrc.cube[tempI][tempJ+1][tempK-1] > threshold && visited[tempEq] == false)
+    using namespace Eigen;
+    const PointMatrix &realPoints = fit.realPoints;
+    int counter = realPoints.rows();
+    double meanX = fit.mean[0];
+    double meanY = fit.mean[1];
+    double meanZ = fit.mean[2];
+
+    //subtract mean from points
+    PointMatrix points(counter, 3);
+    for(int i = 0; i < counter; i++)
+    {
+        points(i, 0) = realPoints(i, 0) - meanX;
+        points(i, 1) = realPoints(i, 1) - meanY;
+        points(i, 2) = realPoints(i, 2) - meanZ;
+    }
+    //perform SVD, only the direction of the line is needed
+    JacobiSVD<PointMatrix> svd(points, ComputeFullV);
+    Vector3f V = svd.matrixV().col(0);
+
+    //output files
+    ofstream outCoordinates101;
+    stringstream ss1;
+    ss1 << x;
+    string fileName121 = path + "GroupRealHelix" + ss1.str() +".pdb";
+    outCoordinates101.open(fileName121.c_str());
+    double result11 = 0;
+    double result21 = 0;
+    double result31 = 0;
+    double minI = -30;
+    double maxI = 0;
+    ///print strait line
+    for(double i = -15; i < 15.01; i+=.1)
+    {
+        result11 = meanX + V(0)*i;
+        result21 = meanY + V(1)*i;
+        result31 = meanZ + V(2)*i;
+        if(result11 > fit.boxMin[0] && result11 < fit.boxMax[0] && result21 > fit.boxMin[1] && result21 < fit.boxMax[1] && result31 > fit.boxMin[2] && result31 < fit.boxMax[2])
         {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
+            if(minI == -30)
+                minI = i;
+            maxI = i;
+            outCoordinates101 << fixed << setprecision(3) << "ATOM      1 CA GLY A   1      " <<  result11 << "    " << result21 << "    " << result31 << endl;
         }
     }
-    //third point
-    if(tempI > 0 && tempJ+1 > 0 && tempK+1 > 0 && tempI < mrc.numRows() && tempJ+1 < mrc.numCols() && tempK+1 < mrc.numSlcs())
-    {
-        tempEq = ((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI));
-        if(notVisited[tempEq] == false && mrc.cube[tempI][tempJ+1][tempK+1] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //fourth point
-    if(tempI > 0 && tempJ-1 > 0 && tempK > 0 && tempI < mrc.numRows() && tempJ-1 < mrc.numCols() && tempK < mrc.numSlcs())
-    {
-        tempEq = ((tempK)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI));
-        if(notVisited[tempEq] == false && mrc.cube[tempI][tempJ-1][tempK] > threshold && visited[tempEq] == false)
+    outCoordinates101.close();
+
+    ///compute curve
+    //every point is taken at the sample of the line closest to it, one of the samples around its projection on the line;
+    //the least squares fit of x, y and z against (1, t, t*t) shares one set of normal equations
+    vector<double> samples;
+    for(double j = minI; j < (maxI+.01); j+=.1)
+        samples.push_back(j);
+    int last = samples.size()-1;
+    double lengthSq = (double)V(0)*V(0) + (double)V(1)*V(1) + (double)V(2)*V(2);
+    Matrix3d tt = Matrix3d::Zero();
+    Matrix3d tp = Matrix3d::Zero();
+    for(int i = 0; i < counter; i++)
+    {
+        double along = (points(i, 0)*V(0) + points(i, 1)*V(1) + points(i, 2)*V(2))/lengthSq;
+        double nearest = floor((along - minI)/.1 + .5);
+        int s = nearest < 0 ? 0 : nearest > last ? last : (int)nearest;
+        double pointsDistance = 1.8 * pow(10,308);
+        double j = samples[s];
+        for(int n = max(s-1, 0); n <= min(s+1, last); n++)
         {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //fifth point
-    if(tempI > 0 && tempJ-1 > 0 && tempK-1 > 0 && tempI < mrc.numRows() && tempJ-1 < mrc.numCols() && tempK-1 < mrc.numSlcs())
-    {
-        tempEq = ((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI));
-        if(notVisited[tempEq] == false && mrc.cube[tempI][tempJ-1][tempK-1] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //sixth point
-    if(tempI > 0 && tempJ-1 > 0 && tempK+1 > 0 && tempI < mrc.numRows() && tempJ-1 < mrc.numCols() && tempK+1 < mrc.numSlcs())
-    {
-        tempEq = ((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI));
-        if(notVisited[tempEq] == false && mrc.cube[tempI][tempJ-1][tempK+1] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //seventh point
-    if(tempI > 0 && tempJ > 0 && tempK-1 > 0 && tempI < mrc.numRows() && tempJ < mrc.numCols() && tempK-1 < mrc.numSlcs())
-    {
-        tempEq = ((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI));
-        if(notVisited[tempEq] == false && mrc.cube[tempI][tempJ][tempK-1] >threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //eighth point
-    if(tempI > 0 && tempJ > 0 && tempK+1 > 0 && tempI < mrc.numRows() && tempJ < mrc.numCols() && tempK+1 < mrc.numSlcs())
-    {
-        tempEq = ((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI));
-        if(notVisited[tempEq] == false && mrc.cube[tempI][tempJ][tempK+1] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    ///i+1
-    //first point
-    if(tempI+1 > 0 && tempJ+1 > 0 && tempK > 0 && tempI+1 < mrc.numRows() && tempJ+1 < mrc.numCols() && tempK < mrc.numSlcs())
-    {
-        tempEq = ((tempK)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI+1));
-        if(notVisited[tempEq] == false && mrc.cube[tempI+1][tempJ+1][tempK] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI+1))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //second point
-    if(tempI+1 > 0 && tempJ+1 > 0 && tempK-1 > 0 && tempI+1 < mrc.numRows() && tempJ+1 < mrc.numCols() && tempK-1 < mrc.numSlcs())
-    {
-        tempEq = ((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI+1));
-        if(notVisited[tempEq] == false && mrc.cube[tempI+1][tempJ+1][tempK-1] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI+1))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //third point
-    if(tempI+1 > 0 && tempJ+1 > 0 && tempK+1 > 0 && tempI+1 < mrc.numRows() && tempJ+1 < mrc.numCols() && tempK+1 < mrc.numSlcs())
-    {
-        tempEq = ((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI+1));
-        if(notVisited[tempEq] == false && mrc.cube[tempI+1][tempJ+1][tempK+1] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI+1))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //fourth point
-    if(tempI+1 > 0 && tempJ-1 > 0 && tempK > 0 && tempI+1 < mrc.numRows() && tempJ-1 < mrc.numCols() && tempK < mrc.numSlcs())
-    {
-        tempEq = ((tempK)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI+1));
-        if(notVisited[tempEq] == false && mrc.cube[tempI+1][tempJ-1][tempK] > threshold && visited[tempEq] == false )
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI+1))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //fifth point
-    if(tempI+1 > 0 && tempJ-1 > 0 && tempK-1 > 0 && tempI+1 < mrc.numRows() && tempJ-1 < mrc.numCols() && tempK-1 < mrc.numSlcs())
-    {
-        tempEq = ((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI+1));
-        if(notVisited[tempEq] == false && mrc.cube[tempI+1][tempJ-1][tempK-1] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI+1))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //sixth point
-    if(tempI+1 > 0 && tempJ-1 > 0 && tempK+1 > 0 && tempI+1 < mrc.numRows() && tempJ-1 < mrc.numCols() && tempK+1 < mrc.numSlcs())
-    {
-        tempEq = ((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI+1));
-        if(notVisited[tempEq] == false && mrc.cube[tempI+1][tempJ-1][tempK+1] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI+1))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //seventh point
-    if(tempI+1 > 0 && tempJ > 0 && tempK-1 > 0 && tempI+1 < mrc.numRows() && tempJ < mrc.numCols() && tempK-1 < mrc.numSlcs())
-    {
-        tempEq = ((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI+1));
-        if(notVisited[tempEq] == false && mrc.cube[tempI+1][tempJ][tempK-1] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI+1))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //eighth point
-    if(tempI+1 > 0 && tempJ > 0 && tempK+1 > 0 && tempI+1 < mrc.numRows() && tempJ < mrc.numCols() && tempK+1 < mrc.numSlcs())
-    {
-        tempEq = ((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI+1));
-        if(notVisited[tempEq] == false && mrc.cube[tempI+1][tempJ][tempK+1] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI+1))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //ninth point
-    if(tempI+1 > 0 && tempJ > 0 && tempK > 0 && tempI+1 < mrc.numRows() && tempJ < mrc.numCols() && tempK < mrc.numSlcs())
-    {
-        tempEq = ((tempK)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI+1));
-        if(notVisited[tempEq] == false && mrc.cube[tempI+1][tempJ][tempK] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI+1))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    ///i-1
-    //first point
-    if(tempI-1 > 0 && tempJ+1 > 0 && tempK > 0 && tempI-1 < mrc.numRows() && tempJ+1 < mrc.numCols() && tempK < mrc.numSlcs())
-    {
-        tempEq = ((tempK)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI-1));
-        if(notVisited[tempEq] == false && mrc.cube[tempI-1][tempJ+1][tempK] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI-1))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //second point
-    if(tempI-1 > 0 && tempJ+1 > 0 && tempK-1 > 0 && tempI-1 < mrc.numRows() && tempJ+1 < mrc.numCols() && tempK-1 < mrc.numSlcs())
-    {
-        tempEq = ((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI-1));
-        if(notVisited[tempEq] == false && mrc.cube[tempI-1][tempJ+1][tempK-1] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI-1))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //third point
-    if(tempI-1 > 0 && tempJ+1 > 0 && tempK+1 > 0 && tempI-1 < mrc.numRows() && tempJ+1 < mrc.numCols() && tempK+1 < mrc.numSlcs())
-    {
-        tempEq = ((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI-1));
-        if(notVisited[tempEq] == false && mrc.cube[tempI-1][tempJ+1][tempK+1] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ+1)*mrc.numRows()+(tempI-1))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //fourth point
-    if(tempI-1 > 0 && tempJ-1 > 0 && tempK > 0 && tempI-1 < mrc.numRows() && tempJ-1 < mrc.numCols() && tempK < mrc.numSlcs())
-    {
-        tempEq = ((tempK)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI-1));
-        if(notVisited[tempEq] == false && mrc.cube[tempI-1][tempJ-1][tempK] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI-1))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //fifth point
-    if(tempI-1 > 0 && tempJ-1 > 0 && tempK-1 > 0 && tempI-1 < mrc.numRows() && tempJ-1 < mrc.numCols() && tempK-1 < mrc.numSlcs())
-    {
-        tempEq = ((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI-1));
-        if(notVisited[tempEq] == false && mrc.cube[tempI-1][tempJ-1][tempK-1] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI-1))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //sixth point
-    if(tempI-1 > 0 && tempJ-1 > 0 && tempK+1 > 0 && tempI-1 < mrc.numRows() && tempJ-1 < mrc.numCols() && tempK+1 < mrc.numSlcs())
-    {
-        tempEq = ((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI-1));
-        if(notVisited[tempEq] == false && mrc.cube[tempI-1][tempJ-1][tempK+1] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ-1)*mrc.numRows()+(tempI-1))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //seventh point
-    if(tempI-1 > 0 && tempJ > 0 && tempK-1 > 0 && tempI-1 < mrc.numRows() && tempJ < mrc.numCols() && tempK-1 < mrc.numSlcs())
-    {
-        tempEq = ((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI-1));
-        if(notVisited[tempEq] == false && mrc.cube[tempI-1][tempJ][tempK-1] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK-1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI-1))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //eighth point
-    if(tempI-1 > 0 && tempJ > 0 && tempK+1 > 0 && tempI-1 < mrc.numRows() && tempJ < mrc.numCols() && tempK+1 < mrc.numSlcs())
-    {
-        tempEq = ((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI-1));
-        if(notVisited[tempEq] == false && mrc.cube[tempI-1][tempJ][tempK+1] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK+1)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI-1))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
-        }
-    }
-    //ninth point
-    if(tempI-1 > 0 && tempJ > 0 && tempK > 0 && tempI-1 < mrc.numRows() && tempJ < mrc.numCols() && tempK < mrc.numSlcs())
-    {
-        tempEq = ((tempK)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI-1));
-        if(notVisited[tempEq] == false && mrc.cube[tempI-1][tempJ][tempK] > threshold && visited[tempEq] == false)
-        {
-            notVisited[tempEq] = true;
-            //tempGroup[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI-1))] = groupNum;
-            returnedNum++;
-            groupCurrent[num] = tempEq;
-            num++;
+            result11 = meanX + V(0)*samples[n];
+            result21 = meanY + V(1)*samples[n];
+            result31 = meanZ + V(2)*samples[n];
+            double distance = sqrt(pow((realPoints(i,0)-result11),2)+pow((realPoints(i,1)-result21),2)+pow((realPoints(i,2)-result31),2));
+            if(distance < pointsDistance)
+            {
+                pointsDistance = distance;
+                j = samples[n];
+            }
         }
+        Vector3d t(1, j, j*j);
+        RowVector3d p(realPoints(i,0), realPoints(i,1), realPoints(i,2));
+        tt += t*t.transpose();
+        tp += t*p;
+    }
+    //columns are the coefficients of x, y and z
+    Matrix3d abc = tt.ldlt().solve(tp);
+
+    ///keep the points of the curve that have a voxel closer than 1
+    Coordinate tmppnt;
+    for(double i = minI-5; i < maxI+5; i+=1)
+    {
+        tmppnt.x = abc(0,0)+abc(1,0)*i+abc(2,0)*i*i;
+        tmppnt.y = abc(0,1)+abc(1,1)*i+abc(2,1)*i*i;
+        tmppnt.z = abc(0,2)+abc(1,2)*i+abc(2,2)*i*i;
+        for(int z = 0; z < counter; z++)
+            if(pow((realPoints(z,0)-tmppnt.x),2)+pow((realPoints(z,1)-tmppnt.y),2)+pow((realPoints(z,2)-tmppnt.z),2) < 1)
+            {
+                fit.helPoints.push_back(tmppnt);
+                break;
+            }
     }
-    //cout << num << " ";
-
-    //for(int i = 0; i < 50; i++)
-    //    cout << tempGroup[i] << " ";
-    //cout << "\n\n";
-    //cout << returnedNum << " ";
-    return returnedNum;
 }
 
-int expandGroup(int tempGroup[], bool visited[], Map mrc, int groupCurrent[], int num, int groupNumber, bool notVisited[], double threshold)
+void linearFit(const Map &mrc, const GroupVoxels &groups, string path, double stepSize, bool one, int &currHel, Protein pdb, int helixOffset, int numSplit, vector<int> groupToSplitArr, bool acute, ThreadPool &pool)
 {
-    int tempI = 0;
-    int tempJ = 0;
-    int tempK = 0;
-    int localCopy = num;
-    for(int i = 0; i < localCopy; i++)
+    int it = 0;
+    int it2 = 0;
+    vector<Coordinate> splitLastPoint;
+    int groupNumber = groups.count();
+    vector<GroupFit> fits(groupNumber);
+
+    //put points in 3d matrix, find mean and the box around them
+    pool.parallelFor(groupNumber, [&](int x)
     {
-        if(groupCurrent[i] != -1)
+        GroupFit &fit = fits[x];
+        fit.realPoints.resize(groups.size(x), 3);
+        for(int d = 0; d < 3; d++)
         {
-            tempK = groupCurrent[i]/(mrc.numCols()*mrc.numRows());
-            tempJ = (groupCurrent[i]-(tempK*mrc.numCols()*mrc.numRows()))/mrc.numRows();
-            tempI = (groupCurrent[i]-(tempK*mrc.numCols()*mrc.numRows())-(tempJ*mrc.numRows()));
-            if(visited[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI))] == false)
+            fit.mean[d] = 0;
+            fit.boxMin[d] = 9999999;
+            fit.boxMax[d] = 0;
+        }
+        for(int n = 0; n < groups.size(x); n++)
+        {
+            Coordinate c = voxelPoint(mrc, groups.voxel(x, n));
+            fit.realPoints(n, 0) = c.x;
+            fit.realPoints(n, 1) = c.y;
+            fit.realPoints(n, 2) = c.z;
+            for(int d = 0; d < 3; d++)
             {
-                visited[((tempK)*mrc.numCols()*mrc.numRows()+(tempJ)*mrc.numRows()+(tempI))] == true;
-                localCopy += regionQueryIt(tempGroup,(tempK*mrc.numCols()*mrc.numRows()+tempJ*mrc.numRows()+tempI), mrc, groupNumber, visited, groupCurrent, num, notVisited, threshold);
-                returnedNum = 0;
+                fit.mean[d] += fit.realPoints(n, d);
+                fit.boxMin[d] = min(fit.boxMin[d], (double)fit.realPoints(n, d));
+                fit.boxMax[d] = max(fit.boxMax[d], (double)fit.realPoints(n, d));
             }
         }
-        else
+        for(int d = 0; d < 3; d++)
+            fit.mean[d] /= max(groups.size(x), 1);
+    });
+    //the box has always grown from group to group rather than starting over
+    for(int x = 1; x < groupNumber; x++)
+        for(int d = 0; d < 3; d++)
         {
-            cout << "WWWWWWWWWRRRRRRRRRRONG";
-            i = localCopy;
+            fits[x].boxMin[d] = min(fits[x].boxMin[d], fits[x-1].boxMin[d]);
+            fits[x].boxMax[d] = max(fits[x].boxMax[d], fits[x-1].boxMax[d]);
         }
 
+    ///fit every group large enough, the groups are independent
+    pool.parallelFor(groupNumber, [&](int x)
+    {
+        if(groups.size(x) > 20)
+            fitGroup(fits[x], x, path);
+    });
 
-    }
-    //cout << localCopy << ": ";
-    return localCopy;
-}
-
-void linearFit(Map mrc, int tempGroup[], int groupNumber, int total[], string path, double stepSize, bool one, int &currHel, Protein pdb, int helixOffset, int numSplit, vector<int> groupToSplitArr, bool acute)
-{
-    int counter = 0;
-    double meanX = 0;
-    double meanY = 0;
-    double meanZ = 0;
-    int tempK = 0;
-    int tempJ = 0;
-    int tempI = 0;
-    double minX = 9999999;
-    double maxX = 0;
-    double minY = 9999999;
-    double maxY = 0;
-    double minZ = 9999999;
-    double maxZ = 0;
-    int it = 0;
-    int it2 = 0;
-    vector<Coordinate> splitLastPoint;
-    //currHel++;
-    ///loop over every group
+    ///output in group order, split groups are trimmed at the end that meets the helix they were split from
     for(int x = 0; x < groupNumber; x++)
     {
-            using namespace Eigen;
-            MatrixXf points(total[x],3);
-            MatrixXf realPoints(total[x], 3);
-            MatrixXf pointx(total[x],1);
-            MatrixXf pointy(total[x],1);
-            MatrixXf pointz(total[x],1);
-            counter = 0;
-            meanX = 0;
-            meanY = 0;
-            meanZ = 0;
-            tempK = 0;
-            tempJ = 0;
-            tempI = 0;
-            //put points in 3d matrix and find mean
-            for(int i = 0; i < mrc.numSlcs()*mrc.numCols()*mrc.numRows(); i++)
-            {
-                if(tempGroup[i] == x)
-                {
+        if(groups.size(x) <= 20)
+            continue;
+        vector<Coordinate> &helPoints = fits[x].helPoints;
+        Axis myAxis;
+        stringstream sstring;
+        sstring << currHel;
+        currHel++;
+        string current_helix_str = sstring.str();
 
-                    tempK = i/(mrc.numCols()*mrc.numRows());
-                    tempJ = (i-(tempK*mrc.numCols()*mrc.numRows()))/mrc.numRows();
-                    tempI = (i-(tempK*mrc.numCols()*mrc.numRows())-(tempJ*mrc.numRows()));
-                    points(counter, 0) = tempI*mrc.apixX+mrc.hdr.xorigin;
-                    points(counter, 1) = tempJ*mrc.apixY+mrc.hdr.yorigin;
-                    points(counter, 2) = tempK*mrc.apixZ+mrc.hdr.zorigin;
-                    realPoints(counter, 0) = tempI*mrc.apixX+mrc.hdr.xorigin;
-                    realPoints(counter, 1) = tempJ*mrc.apixY+mrc.hdr.yorigin;
-                    realPoints(counter, 2) = tempK*mrc.apixZ+mrc.hdr.zorigin;
-                    pointx(counter, 0) = tempI*mrc.apixX+mrc.hdr.xorigin;
-                    pointy(counter, 0) = tempJ*mrc.apixY+mrc.hdr.yorigin;
-                    pointz(counter, 0) = tempK*mrc.apixZ+mrc.hdr.zorigin;
-
-                    meanX += (tempI*mrc.apixX+mrc.hdr.xorigin);
-                    if((tempI*mrc.apixX+mrc.hdr.xorigin) > maxX)
-                        maxX = (tempI*mrc.apixX+mrc.hdr.xorigin);
-                    if((tempI*mrc.apixX+mrc.hdr.xorigin) < minX)
-                        minX = (tempI*mrc.apixX+mrc.hdr.xorigin);
-
-                    meanY += (tempJ*mrc.apixY+mrc.hdr.yorigin);
-                    if((tempJ*mrc.apixY+mrc.hdr.yorigin) > maxY)
-                        maxY = (tempJ*mrc.apixY+mrc.hdr.yorigin);
-                    if((tempJ*mrc.apixY+mrc.hdr.yorigin) < minY)
-                        minY = (tempJ*mrc.apixY+mrc.hdr.yorigin);
-
-                    meanZ += (tempK*mrc.apixZ+mrc.hdr.zorigin);
-                    if((tempK*mrc.apixZ+mrc.hdr.zorigin) > maxZ)
-                        maxZ = (tempK*mrc.apixZ+mrc.hdr.zorigin);
-                    if((tempK*mrc.apixZ+mrc.hdr.zorigin) < minZ)
-                        minZ = (tempK*mrc.apixZ+mrc.hdr.zorigin);
-
-                    counter++;
-                }
-            }
-            ///if group is large enough
-            if(counter > 20)
-            {
-                meanX /= counter;
-                meanY /= counter;
-                meanZ /= counter;
-                //subtract mean from points
-                for(int i = 0; i < counter; i++)
-                {
-                    points(i, 0) -= meanX;
-                    points(i, 1) -= meanY;
-                    points(i, 2) -= meanZ;
-                }
-                //perform SVD
-                MatrixXf V(3,3);
-                JacobiSVD<MatrixXf> svd(points, ComputeThinU | ComputeThinV);
-                V = svd.matrixV();
-
-                //output files
-                ofstream outCoordinates101;
-                string fileName121 = "";
-                stringstream ss1;
-                ss1 << x;
-                string str2 = ss1.str();
-                fileName121 = path + "GroupRealHelix" + str2 +".pdb";
-                outCoordinates101.open(fileName121.c_str());
-                double result11 = 0;
-                double result21 = 0;
-                double result31 = 0;
-                double minI = -30;
-                double maxI = 0;
-                double distance2 = 0;
-                double minDistance = 999999999999999999999999;
-                //cout << V(0,0) << "  " << V(0,1) << "  " << V(0,2) << endl;
-                ///print strait line
-                for(double i = -15; i < 15.01; i+=.1)
-                {
-                    minDistance = 999999999999999999999999;
-                    result11 = meanX + V(0,0)*i;
-                    result21 = meanY + V(1,0)*i;
-                    result31 = meanZ + V(2,0)*i;
-                    //find min distance to shorten axis
-                    for(int z = 0; z < total[x]; z++)
-                    {
-                        distance2 = sqrt(pow((realPoints(z,0)-result11),2)+pow((realPoints(z,1)-result21),2)+pow((realPoints(z,2)-result31),2));
-                        if(distance2 < minDistance)
-                            minDistance = distance2;
-                    }
-                    if(result11 > minX && result11 < maxX && result21 > minY && result21 < maxY && result31 > minZ && result31 < maxZ)
-                    {
-                        if(minI == -30)
-                            minI = i;
-                        maxI = i;
-                        outCoordinates101 << fixed << setprecision(3) << "ATOM      1 CA GLY A   1      " <<  result11 << "    " << result21 << "    " << result31 << endl;
-                    }
-                }
-                outCoordinates101.close();
+        if(acute == true && x >= groupNumber-numSplit)
+        {
+            double dist1 = 0;
+            double dist2 = 0;
+            dist1 = sqrt(pow((splitLastPoint[it2].x-helPoints[0].x),2)+pow((splitLastPoint[it2].y-helPoints[0].y),2)+pow((splitLastPoint[it2].z-helPoints[0].z),2));
+            dist2 = sqrt(pow((splitLastPoint[it2].x-helPoints[helPoints.size()-1].x),2)+pow((splitLastPoint[it2].y-helPoints[helPoints.size()-1].y),2)+pow((splitLastPoint[it2].z-helPoints[helPoints.size()-1].z),2));
 
-                ///compute curve
-                MatrixXf t(total[x],3);
-                double pointsDistance[counter];
-                double distance = 0;
-                for(int i = 0; i < counter; i++)
-                {
-                    pointsDistance[i] = 1.8 * pow(10,308);
-                }
-                for(int i = 0; i < counter; i++)
-                {
-                    for(double j = minI; j < (maxI+.01); j+=.1)
-                    {
-                        result11 = meanX + V(0,0)*j;
-                        result21 = meanY + V(1,0)*j;
-                        result31 = meanZ + V(2,0)*j;
-                        distance = sqrt(pow((realPoints(i,0)-result11),2)+pow((realPoints(i,1)-result21),2)+pow((realPoints(i,2)-result31),2));
-                        if(distance < pointsDistance[i])
-                        {
-                            pointsDistance[i] = distance;
-                            t(i,0) = 1;
-                            t(i,1) = j;
-                            t(i,2) = j*j;
-                        }
-                    }
-                }
-                MatrixXf a(3,1);
-                MatrixXf b(3,1);
-                MatrixXf c(3,1);
-                a = t.jacobiSvd(ComputeThinU | ComputeThinV).solve(pointx);
-                b = t.jacobiSvd(ComputeThinU | ComputeThinV).solve(pointy);
-                c = t.jacobiSvd(ComputeThinU | ComputeThinV).solve(pointz);
-
-                ///outputCurve
-                string fileName12 = "";
-                stringstream ss;
-                ss << x;
-                string str = "";
-                str = ss.str();
-                double result1 = 0;
-                double result2 = 0;
-                double result3 = 0;
-                Coordinate tmppnt;
-                vector<Coordinate> helPoints;
-                Axis myAxis;
-                stringstream sstring;
-                sstring << currHel;
-                currHel++;
-                string current_helix_str = sstring.str();
+            if(dist1 < dist2)
+            {
+                vector<Coordinate> temp;
+                temp = helPoints;
 
-                for(double i = minI-5; i < maxI+5; i+=1)
+                helPoints.clear();
+                for(int r = 5; r < temp.size(); r++)
                 {
-                    minDistance = 999999999999999999999999;
-                    result1 = a(0,0)+a(1,0)*i+a(2,0)*i*i;
-                    result2 = b(0,0)+b(1,0)*i+b(2,0)*i*i;
-                    result3 = c(0,0)+c(1,0)*i+c(2,0)*i*i;
-                    for(int z = 0; z < total[x]; z++)
-                    {
-                        distance2 = sqrt(pow((realPoints(z,0)-result1),2)+pow((realPoints(z,1)-result2),2)+pow((realPoints(z,2)-result3),2));
-                        if(distance2 < minDistance)
-                            minDistance = distance2;
-                    }
-                    tmppnt.x = result1;
-                    tmppnt.y = result2;
-                    tmppnt.z = result3;
-                    if(minDistance < 1 )
-                        helPoints.push_back(tmppnt);
+                    helPoints.push_back(temp[r]);
                 }
-                if(acute == true && x >= groupNumber-numSplit)
-                {
-                    double dist1 = 0;
-                    double dist2 = 0;
-                    dist1 = sqrt(pow((splitLastPoint[it2].x-helPoints[0].x),2)+pow((splitLastPoint[it2].y-helPoints[0].y),2)+pow((splitLastPoint[it2].z-helPoints[0].z),2));
-                    dist2 = sqrt(pow((splitLastPoint[it2].x-helPoints[helPoints.size()-1].x),2)+pow((splitLastPoint[it2].y-helPoints[helPoints.size()-1].y),2)+pow((splitLastPoint[it2].z-helPoints[helPoints.size()-1].z),2));
-
-                    if(dist1 < dist2)
-                    {
-                        vector<Coordinate> temp;
-                        temp = helPoints;
-
-                        helPoints.clear();
-                        for(int r = 5; r < temp.size(); r++)
-                        {
-                            helPoints.push_back(temp[r]);
-                        }
-                    }
-                    else
-                    {
-                        helPoints.pop_back();
-                        helPoints.pop_back();
-                        helPoints.pop_back();
-                        helPoints.pop_back();
-                        helPoints.pop_back();
-                    }
+            }
+            else
+            {
+                helPoints.pop_back();
+                helPoints.pop_back();
+                helPoints.pop_back();
+                helPoints.pop_back();
+                helPoints.pop_back();
+            }
 
-                    it2++;
-                }
+            it2++;
+        }
 
-                if(acute == true && groupToSplitArr[it] == x)
-                {
-                    splitLastPoint.push_back(helPoints[helPoints.size()-1]);
-                    it++;
-                }
-                myAxis.axisPoints = helPoints;
-                myAxis.catmullRom(stepSize);
+        if(acute == true && groupToSplitArr[it] == x)
+        {
+            splitLastPoint.push_back(helPoints[helPoints.size()-1]);
+            it++;
+        }
+        myAxis.axisPoints = helPoints;
+        myAxis.catmullRom(stepSize);
 
-                fileName12 = path + "/output/traceHelix" + current_helix_str + ".pdb";
+        string fileName12 = path + "/output/traceHelix" + current_helix_str + ".pdb";
 
-                myAxis.printAsPnts2(fileName12);
-                helTraceArray.push_back(myAxis);
-                helPoints.clear();
-            }
+        myAxis.printAsPnts2(fileName12);
+        helTraceArray.push_back(myAxis);
     }
 }
 
-void outputPoints(Map mrc, string path, double threshold)
+void outputPoints(const Map &mrc, string path, double threshold)
 {
     ofstream outCoordinates100;
     string fileName120 = "";
@@ -2432,3 +1787,16 @@ void outputPoints(Map mrc, string path, double threshold)
             }
     outCoordinates100.close();
 }
+
+///position in A of voxel n of the map, counted in file order (x fastest); needs only the header, so streamed maps work too
+Coordinate voxelPoint(const Map &mrc, size_t n)
+{
+    Coordinate c;
+    int i = n % mrc.hdr.nx;
+    int j = (n / mrc.hdr.nx) % mrc.hdr.ny;
+    int k = n / ((size_t)mrc.hdr.nx*mrc.hdr.ny);
+    c.x = i*mrc.apixX+mrc.hdr.xorigin;
+    c.y = j*mrc.apixY+mrc.hdr.yorigin;
+    c.z = k*mrc.apixZ+mrc.hdr.zorigin;
+    return c;
+}
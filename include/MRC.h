@@ -23,11 +23,17 @@
 #include <queue>
 #include <math.h>
 #include <limits.h>
+#include <string.h>
+#include <type_traits>
 #include "protein.h"
 #include "constants.h"
 #include "geometry.h"
-#include "jacobi.h"
+#include "symtensor.h"
 #include "skeleton_overall.h"
+#include "voxelgrid.h"
+#include "threadpool.h"
+#include "convolve.h"
+#include "voxelpipe.h"
 
 using namespace std;
 
@@ -80,6 +86,50 @@ bool operator<(const peakCell &a, const peakCell &b)
 	return a.peak  < b.peak ;
 }
 
+//the voxels of a sphere around a voxel, as steps and as offsets in the cube, in the order of a loop over
+//di, then dj, then dk; the table is symmetric, -d is in it for every d
+struct SphereOffsets{
+	vector<int> di, dj, dk;
+	vector<long> flat;
+	int reach[3];		//largest step along x, y and z
+
+	//steps up to maxSteps with (di*sx)^2 + (dj*sy)^2 + (dk*sz)^2 <= radius^2
+	SphereOffsets(double radius, double sx, double sy, double sz, int maxSteps, int nx, int ny)
+	{
+		reach[0] = reach[1] = reach[2] = 0;
+		for (int i=-maxSteps; i<=maxSteps; i++)
+			for (int j=-maxSteps; j<=maxSteps; j++)
+				for (int k=-maxSteps; k<=maxSteps; k++)
+					if ((i*sx)*(i*sx) + (j*sy)*(j*sy) + (k*sz)*(k*sz) <= radius*radius){
+						di.push_back(i);
+						dj.push_back(j);
+						dk.push_back(k);
+						flat.push_back(i + (long)nx*(j + (long)ny*k));
+						reach[0] = max(reach[0], abs(i));
+						reach[1] = max(reach[1], abs(j));
+						reach[2] = max(reach[2], abs(k));
+					}
+	}
+
+	inline int size() const {return flat.size();}
+
+	//calls body(n) for every voxel n of the sphere around i, j, k that lies inside an nx*ny*nz cube
+	template <typename Body>
+	inline void forEachInside(int i, int j, int k, int nx, int ny, int nz, Body body) const
+	{
+		long n = i + (long)nx*(j + (long)ny*k);
+		if (i >= reach[0] && j >= reach[1] && k >= reach[2] && i < nx-reach[0] && j < ny-reach[1] && k < nz-reach[2]){
+			for (int o=0; o<size(); o++)
+				body(n + flat[o]);
+		}
+		else{
+			for (int o=0; o<size(); o++)
+				if (i+di[o] >= 0 && j+dj[o] >= 0 && k+dk[o] >= 0 && i+di[o] < nx && j+dj[o] < ny && k+dk[o] < nz)
+					body(n + flat[o]);
+		}
+	}
+};
+
 
 
 /*
@@ -214,9 +264,12 @@ struct Gradient
 
 struct Tensor
 {
-  vector<vector<float> > Hmatrix;      //Hessian matrix
-  vector<float> Evalue;                //Eigenvalue
-  vector<vector<float> > Evector;      //Eigenvector
+  SymTensor Hmatrix;                   //Hessian matrix
+  float Evalue[3];                     //Eigenvalue, largest first
+  float Evector[3][3];                 //Eigenvector, Evector[n] goes with Evalue[n]
+
+  //initializer
+  Tensor() : Evalue(), Evector() {}
 };
 
 struct Thickness
@@ -261,15 +314,13 @@ public:
     float apixX;								//Angstrom per pixel ratio for X direction
 	float apixY;
 	float apixZ;
-	vector<vector<vector<vxlDataType> > >	cube;   // voxel density value
-	vector<vector<vector<Gradient> > >	 grad;      // voxel gradient
-	vector<vector<vector<Tensor> > >   tens;        // voxel tenser
-	vector<vector<vector<Thickness> > >   thick;    // voxel thickness
-	vector<vector<vector<float> > >   dt;           // Distance Transform
-	vector<vector<vector<float> > >   dr;           // DT value of the Distance Ridge / Medial Axis
-    //vector<vector<vector<float> > >   localThick;   // local thickness derived from DT and DR
-
-    vector<vector<vector<Node> > >	node;   //vector for all the voxels in map, for filerting small groups
+	VoxelGrid<vxlDataType>	cube;   // voxel density value, cube[row][col][slice], stored in file order
+	VoxelGrid<Gradient>	 grad;      // voxel gradient
+	VoxelGrid<Tensor>   tens;        // voxel tenser
+	VoxelGrid<Thickness>   thick;    // voxel thickness
+	VoxelGrid<float>   dt;           // Distance Transform
+	VoxelGrid<float>   dr;           // DT value of the Distance Ridge / Medial Axis
+    //VoxelGrid<float>   localThick;   // local thickness derived from DT and DR
 
 
     void setApix();								//set Apix values
@@ -278,35 +329,46 @@ public:
 	void printInfo();                           //print mapp information
 	void createCube(short, short, short);		//create the grid of the size by given dimensions	(rows, cols, slices)
 	void filterize(float);						//filterize the map using a threshold
-	short numRows();							//returns number of rows in grid3D
-	short numCols();							//returns number of cols in grid3D
-	short numSlcs();							//returns number of slices in grid3D (depth)
+	DensityStats process(const VoxelPipeline&, ThreadPool&);	//apply the point steps in one pass over the grid, returns stats of the result
+	short numRows() const;						//returns number of rows in grid3D
+	short numCols() const;						//returns number of cols in grid3D
+	short numSlcs() const;						//returns number of slices in grid3D (depth)
 	void cleanVxls(vector<vector<Coordinate> >, float);	//given a set of sticks and a radius, clean the voxels around each stick within the given radius (in A)
 	void traceDensity(Coordinate, Coordinate, short, vector<Coordinate>&);	//given two indeces in the Cryo-EM map and the length of the sequence (in terms of #AA) is expected between them
 																			//it saves the trace points into a vector, if the sequence does not fit b/w the two points...
 	void localPeaks(Coordinate, Coordinate, short, vector<Coordinate>&, float);			//find local Peaks b/w two points by applying a sphere around each voxel and calculate the average of density
 																						//for each voxel inside that sphere has a density larger than the average will be (its counter) by 1
+	void localPeaks(ThreadPool&, Coordinate, Coordinate, short, vector<Coordinate>&, float);
 	void localPeaksMap(vector<Coordinate>&, vector<vector<Coordinate> >, float, float);		//find local peaks for he entire map
+	void localPeaksMap(ThreadPool&, vector<Coordinate>&, vector<vector<Coordinate> >, float, float);
 
 
     /////////////////////////////////////////////--- added by Dong/////////////////////////////////////////////////
-    void gauss_smooth();
+    void gauss_smooth();                        //7 tap gaussian, the 3 voxels next to the edge are kept
+    void gauss_smooth(ThreadPool &pool, const SeparableFilter &filter, BorderPolicy border = BORDER_KEEP);
     void buildGradient(int fast);               //build the gradient for each voxel
     void buildTensor();
+    void buildTensor(ThreadPool &pool);
     void buildThickness(float threshold);
+    void buildThickness(ThreadPool &pool, float threshold, float maxLength = 0);     //maxLength in A, 0 for rays of any length
     void normalize();
     void update_hdrInfo();                      //update the header info after modify the density map (ex. gauss)
+    void update_hdrInfo(const DensityStats &stats);
 
-    void EDT();                                 //Saito-Toriwaki algorithm for Euclidian Distance Transformation.
+    void EDT();                                 //exact Euclidian Distance Transformation, separable in linear time
+    void EDT(ThreadPool &pool);
     void DR();                                  //detect the distance ridge/medial axis from the distance map
+    void DR(ThreadPool &pool);
     vector<vector<int> > createTemplate(vector<int> distSqValues);          // Build template --- sub-function of DR()
     vector<int> scanCube(int dx, int dy, int dz, vector<int> distSqValues);   // scan Cube --- sub-function of DR();
     float LocalThickness(int x, int y, int z);                   //local thickness derived from DT and DR for a centain voxel
 
     void LocalPeakFilter(int divider);  //local peak filter for selecting backbone voxels. filter the voxels has LPC less than MAX_LPC/divider
+    void LocalPeakFilter(ThreadPool &pool, int divider);
 
     float dist(Node p1, Node p2); //calculate the distance btw to nodes based on voxel
-    void AddNearbyNodes(Node d, vector<Node> & group);     //add nearby voxel into group
+    void clusterVoxels(vector<vector<Node> > & groups);     //groups of voxels above 0 that share a face
+    float farthestPair(const vector<Node> & group, int & first, int & second);   //the two nodes of a group furthest apart
     void deleteSmallVxlGroup(float minLength, float minSize);  //delete small voxel group that has length smaller than minLength
 
     void Output_HLX(string pdbID, vector<Coordinate> curve_pnts);  //output helix stick files
@@ -327,15 +389,118 @@ private:
 
 
 /*
- *		DENSITY MAP : CLASS Implementation
+ *		MRC data block : byte order and mode conversion
  */
-void Map::read (string mrcFname)
+inline bool hostIsLittleEndian()
 {
-	ifstream inMapF;	//map file
-	int iRow,
-		iCol,
-		iDepth;				//regular counters
+	const int one = 1;
+	return *(const char*)&one == 1;
+}
+
+// reverse the byte order of count 2 or 4 byte words in place
+void swapBytes2(void* data, size_t count)
+{
+	unsigned short* w = (unsigned short*)data;
+	for (size_t n = 0; n < count; n++)
+		w[n] = (unsigned short)((w[n] >> 8) | (w[n] << 8));
+}
+void swapBytes4(void* data, size_t count)
+{
+	unsigned int* w = (unsigned int*)data;
+	for (size_t n = 0; n < count; n++)
+		w[n] = (w[n] >> 24) | ((w[n] >> 8) & 0xFF00) | ((w[n] << 8) & 0xFF0000) | (w[n] << 24);
+}
+
+// Byte order of the file: the first byte of the machine stamp is 0x44 for little and 0x11 for big endian.
+// Many writers leave the stamp empty, in that case the order in which mode reads as a small number wins.
+bool mrcIsLittleEndian(const MRC_HEADER &h)
+{
+	unsigned char first = ((const unsigned char*)&h.machineStamp)[0];
+	if (first == 0x44)
+		return true;
+	if (first == 0x11)
+		return false;
+	return (h.mode >= 0 && h.mode <= 16) ? hostIsLittleEndian() : !hostIsLittleEndian();
+}
+
+// every number in the header, i.e. everything but the "MAP " string, the machine stamp and the labels
+void swapHeader(MRC_HEADER &h)
+{
+	swapBytes4(&h, ((const char*)h.map - (const char*)&h) / 4);
+	swapBytes4(&h.rms, 2);		//rms, nlabl
+}
+
+void setNativeMachineStamp(MRC_HEADER &h)
+{
+	unsigned char stamp[4] = {0x11, 0x11, 0, 0};
+	if (hostIsLittleEndian())
+	{
+		stamp[0] = 0x44;
+		stamp[1] = 0x41;
+	}
+	memcpy(&h.machineStamp, stamp, 4);
+}
+
+// bytes per voxel of the modes we read (0: signed bytes, 1: shorts, 2: floats, 6: unsigned shorts), 0 for the rest
+int mrcModeSize(int mode)
+{
+	switch (mode)
+	{
+		case 0: return 1;
+		case 1: return 2;
+		case 2: return 4;
+		case 6: return 2;
+		default: return 0;
+	}
+}
+
+template <typename In>
+void widenVoxels(const In* in, size_t count, vxlDataType* out)
+{
+	for (size_t n = 0; n < count; n++)
+		out[n] = (vxlDataType)in[n];
+}
 
+// Reads count voxels in one call. Floats in the host byte order go straight into out, everything
+// else is read raw, swapped if needed and converted in a single pass.
+// Returns false if the file ends early.
+bool readVoxelBlock(istream &in, int mode, bool swapped, vxlDataType* out, size_t count)
+{
+	int size = mrcModeSize(mode);
+
+	if (mode == 2 && is_same<vxlDataType, float>::value)
+	{
+		in.read((char*)out, count*size);
+		if ((size_t)in.gcount() != count*size)
+			return false;
+		if (swapped)
+			swapBytes4(out, count);
+		return true;
+	}
+
+	vector<char> raw(count*size);
+	in.read(raw.data(), raw.size());
+	if ((size_t)in.gcount() != raw.size())
+		return false;
+	if (swapped && size == 2)
+		swapBytes2(raw.data(), count);
+	if (swapped && size == 4)
+		swapBytes4(raw.data(), count);
+
+	switch (mode)
+	{
+		case 0: widenVoxels((const signed char*)raw.data(), count, out); break;
+		case 1: widenVoxels((const short*)raw.data(), count, out); break;
+		case 2: widenVoxels((const float*)raw.data(), count, out); break;
+		case 6: widenVoxels((const unsigned short*)raw.data(), count, out); break;
+	}
+	return true;
+}
+
+// Opens a map file and reads its header into hdr, converted to the byte order of this machine.
+// The stream is left at the first voxel. Returns true if the voxels need their bytes swapped.
+bool openMRC(ifstream &inMapF, string mrcFname, MRC_HEADER &hdr)
+{
 	//open given mrc file
 	inMapF.open (mrcFname.c_str (), ios::binary);
 
@@ -350,6 +515,10 @@ void Map::read (string mrcFname)
 	 */
 	inMapF.read ((char*)(&hdr), sizeof(MRC_HEADER));
 
+	bool swapped = mrcIsLittleEndian(hdr) != hostIsLittleEndian();
+	if (swapped)
+		swapHeader(hdr);
+
     if ( hdr.nx <= 0 || hdr.nx >= MAXLEN ||
 		hdr.ny <= 0 || hdr.ny >= MAXLEN ||
 		hdr.nz <= 0 || hdr.nz >= MAXLEN )
@@ -360,6 +529,31 @@ void Map::read (string mrcFname)
 		exit(1);
 	}
 
+	if (mrcModeSize(hdr.mode) == 0)
+	{
+		cout<<"============================== in MRC::read (string) =========================="<<endl;
+		cout<<"Unsupported map mode ( "<<hdr.mode<<" ). Only modes 0, 1, 2 and 6 can be read."<<endl;
+		cout<<"==============================================================================="<<endl;
+		exit(1);
+	}
+
+	//the voxels follow the symmetry records if there are any
+	if (hdr.nsymbt > 0)
+		inMapF.seekg (sizeof(MRC_HEADER) + hdr.nsymbt);
+
+	return swapped;
+}
+
+
+/*
+ *		DENSITY MAP : CLASS Implementation
+ */
+void Map::read (string mrcFname)
+{
+	ifstream inMapF;	//map file
+
+	bool swapped = openMRC(inMapF, mrcFname, hdr);
+
 	/*
 	 *		Set Apix ratios
 	 */
@@ -370,12 +564,18 @@ void Map::read (string mrcFname)
 	/*
 	 *		Read map data (Voxels)
 	 */
+	if (!readVoxelBlock(inMapF, hdr.mode, swapped, cube.data(), cube.count()))
+	{
+		cout<<"============================== in MRC::read (string) =========================="<<endl;
+		cout<<"Map file ( "<<mrcFname<<" ) ends before all "<<cube.count()<<" voxels were read."<<endl;
+		cout<<"==============================================================================="<<endl;
+		exit(1);
+	}
 
-	for (iDepth=0; iDepth<hdr.nz; iDepth++)
-		for (iCol=0; iCol<hdr.ny; iCol++)
-			for (iRow=0; iRow<hdr.nx; iRow++)
-				// Read one cell at a time
-				inMapF.read ((char *) &cube[iRow][iCol][iDepth], sizeOfVxl);
+	//the cube holds floats in the byte order of this machine now, and that is what write() puts out
+	hdr.mode = 2;
+	hdr.nsymbt = 0;
+	setNativeMachineStamp(hdr);
 }
 /////////////////////////////////////////////////////////////////////////////////
 void Map::write (string outFileName)
@@ -393,22 +593,15 @@ void Map::write (string outFileName)
 		exit(1);
 	}
 	/*
-	 *		write the header first
+	 *		write the header first, the voxels go out in the byte order of this machine
 	 */
+	setNativeMachineStamp(hdr);
 	outMapF.write ((char *) &hdr, sizeof(MRC_HEADER));
 
 	/*
-	 *		write the grid
+	 *		write the grid, it is already in file order
 	 */
-	int iRow,
-		iCol,
-		iDepth;		//regular counters
-
-	for (iDepth = 0; iDepth <numSlcs(); iDepth++)
-		for (iCol=0; iCol<numCols(); iCol++)
-			for (iRow=0; iRow<numRows(); iRow++)
-				//write cell at a time
-				outMapF.write ((char *) &cube[iRow][iCol][iDepth], sizeOfVxl);
+	outMapF.write ((char *) cube.data(), cube.count() * sizeOfVxl);
 
 	outMapF.close();
 }
@@ -439,17 +632,10 @@ void Map::createCube(short nX, short nY, short nZ)
 	// set slice length
 	slcLen = nX * nY;
 
-	cube.resize(nX);			//resize rows according to nx
-
-	for(int iRow=0; iRow<nX; iRow++){
-		cube[iRow].resize(nY);		// resize cols according to ny ..  generate ny cols for each row
-
-		for (int iCol=0; iCol<nY; iCol++)
-			cube[iRow][iCol].resize(nZ);	//resize depth according to nz .. generate nz slices for each cell
-	}
+	cube.resize(nX, nY, nZ);	//nx rows, ny cols, nz slices in one block, rows changing fastest
 
 	//set the size of voxel (the size of data type used)
-	sizeOfVxl = sizeof(cube[0][0][0]);
+	sizeOfVxl = sizeof(vxlDataType);
 }
 ////////////////////////////////////////////////////////////////////////////////////////
 // Delete densities around a stick within a given radius
@@ -571,12 +757,12 @@ void Map::cleanVxls(vector<vector<Coordinate> > ssEdges, float radius)
 		//cout<<endl<<endl<<"STK "<<i+1<<endl;
 		//cout<<"Number of segments = "<<stkSegments.size ()<<endl;
 		//cout<<"StartIndx= "<<startIndx<<"  EndIndx="<< endIndx<<endl;
-		for (irow=0; irow<numRows(); irow++){
-			mapP.x = irow;
+		for (islc=0; islc<numSlcs(); islc++){
+			mapP.z = islc;
 			for (icol=0; icol<numCols(); icol++){
 				mapP.y = icol;
-				for (islc=0; islc<numSlcs(); islc++){
-					mapP.z = islc;
+				for (irow=0; irow<numRows(); irow++){
+					mapP.x = irow;
 					if (cube[irow][icol][islc] > 0){
 						bool closeToOther = false;
 						for (j=0; j<stkSegments.size ()-1; j++){
@@ -691,6 +877,12 @@ void Map::traceDensity (Coordinate sIndx, Coordinate eIndx, short nAA, vector<Co
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 //given point is in MAP indexing system not in XYZ
 void Map::localPeaks(Coordinate sIndx, Coordinate eIndx, short nAA, vector<Coordinate>& peaks, float prcntg)
+{
+	ThreadPool pool;
+	localPeaks(pool, sIndx, eIndx, nAA, peaks, prcntg);
+}
+
+void Map::localPeaks(ThreadPool &pool, Coordinate sIndx, Coordinate eIndx, short nAA, vector<Coordinate>& peaks, float prcntg)
 {
     setApix();
 
@@ -702,20 +894,11 @@ void Map::localPeaks(Coordinate sIndx, Coordinate eIndx, short nAA, vector<Coord
 
 	float sphereR = 3*apixX;							//sphere radius in Angstrom
 	short sphereVxl = (short) (sphereR + 1.5*apixX);	//a variable used to estimate number of vxl to check around target voxel to form a asphere
-	short ix, iy, iz, i, j, k;
+	short ix, iy, iz, i;
+	int nx = numRows(), ny = numCols(), nz = numSlcs();
 
-	//define and initiate local counters
-	short ***lCntrs;
-	lCntrs = new short **[numRows()];
-	for (i=0; i<numRows(); i++)
-		lCntrs[i] = new short *[numCols()];
-	for (i=0; i<numRows(); i++)
-		for (j=0; j<numCols(); j++){
-			lCntrs[i][j] = new short[numSlcs()];
-
-			for (k=0; k<numSlcs(); k++)
-				lCntrs[i][j][k] = 0;
-		}
+	//the voxels within sphereR, taking every axis as apixX as the distances always have
+	SphereOffsets sphere(sphereR, apixX, apixX, apixX, sphereVxl, nx, ny);
 
 	/*
 	 *		find local maximum for all voxels.....
@@ -723,65 +906,51 @@ void Map::localPeaks(Coordinate sIndx, Coordinate eIndx, short nAA, vector<Coord
 	 *		avg density increment its local counter by 1
 	 *		then sort all local peak counter and pick up top percentage
 	 */
-	Coordinate pnt;
-	for (ix=0; ix<numRows(); ix++) {
-		pnt.x = ix;
-		for (iy=0; iy<numCols(); iy++) {
-			pnt.y = iy;
-			for (iz=0; iz<numSlcs(); iz++) {
-				pnt.z = iz;
-				if (getDistance(sIndx, pnt)*apixX + getDistance(pnt, eIndx)*apixX < seqDist){		//check if this point is accessible for the portion
-
-					//calculate average density in the sphere
-					float avgD=0;
-					short cntr=1;		//points included counter
-
-					Coordinate pnt_;
-
-					for (i=-sphereVxl; i<=sphereVxl; i++) {
-						if (ix+i>-1 && ix+i<numRows()){
-							pnt_.x = ix+i;
-							for (j=-sphereVxl; j<=sphereVxl; j++) {
-								if (iy+j>-1 && iy+j<numCols()){
-									pnt_.y = iy+j;
-									for (k=-sphereVxl; k<=sphereVxl; k++) {
-										if (iz+k>-1 && iz+k<numSlcs()){
-											pnt_.z = iz+k;
-											if (cube[ix+i][iy+j][iz+k]>0 && getDistance(pnt, pnt_)*apixX <= sphereR){
-												avgD += cube[ix+i][iy+j][iz+k];
-												cntr++;
-											}
-										}
-									}
-								}
-							}
-						}
-					}
-					avgD /= cntr;
-
-					//increment local counters for those voxels who has density greater than the avg density
-					for (i=-sphereVxl; i<=sphereVxl; i++) {
-						if (ix+i>-1 && ix+i<numRows()){
-							pnt_.x = ix+i;
-							for (j=-sphereVxl; j<=sphereVxl; j++) {
-								if (iy+j>-1 && iy+j<numCols()){
-									pnt_.y = iy+j;
-									for (k=-sphereVxl; k<=sphereVxl; k++) {
-										if (iz+k>-1 && iz+k<numSlcs()){
-											pnt_.z = iz+k;
-											if (cube[ix+i][iy+j][iz+k]>avgD && getDistance(pnt, pnt_)*apixX <= sphereR){
-												lCntrs[ix+i][iy+j][iz+k]++;
-											}
-										}
-									}
-								}
+	int chunks = pool.size();
+
+	//average density in the sphere around each voxel accessible for the portion, HUGE_VALF for the rest
+	VoxelGrid<float> avgD(nx, ny, nz, HUGE_VALF);
+	pool.parallelFor(chunks, [&](int c)
+	{
+		Coordinate pnt;
+		for (int z = c*nz/chunks; z < (c+1)*nz/chunks; z++) {
+			pnt.z = z;
+			for (int y=0; y<ny; y++) {
+				pnt.y = y;
+				for (int x=0; x<nx; x++) {
+					pnt.x = x;
+					if (getDistance(sIndx, pnt)*apixX + getDistance(pnt, eIndx)*apixX < seqDist){		//check if this point is accessible for the portion
+						float sum=0;
+						short cntr=1;		//points included counter
+						sphere.forEachInside(x, y, z, nx, ny, nz, [&](long n){
+							if (cube.at(n)>0){
+								sum += cube.at(n);
+								cntr++;
 							}
-						}
+						});
+						avgD(x, y, z) = sum/cntr;
 					}
 				}
 			}
 		}
-	}
+	});
+
+	//local counter of each voxel: the spheres around it whose average density it is above, gathered by
+	//every voxel itself as the sphere is symmetric
+	VoxelGrid<short> lCntrs(nx, ny, nz, 0);
+	pool.parallelFor(chunks, [&](int c)
+	{
+		for (int z = c*nz/chunks; z < (c+1)*nz/chunks; z++)
+			for (int y=0; y<ny; y++)
+				for (int x=0; x<nx; x++) {
+					float density = cube(x, y, z);
+					short cntr = 0;
+					sphere.forEachInside(x, y, z, nx, ny, nz, [&](long n){
+						cntr += density>avgD.at(n);
+					});
+					lCntrs(x, y, z) = cntr;
+				}
+	});
 
 	peakCell tmpCell;
 	priority_queue<peakCell> localPks;
@@ -812,6 +981,12 @@ void Map::localPeaks(Coordinate sIndx, Coordinate eIndx, short nAA, vector<Coord
 }
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 void Map::localPeaksMap(vector<Coordinate> &pnts, vector<vector<Coordinate> > ssEdges, float radius, float peakTHRg)
+{
+	ThreadPool pool;
+	localPeaksMap(pool, pnts, ssEdges, radius, peakTHRg);
+}
+
+void Map::localPeaksMap(ThreadPool &pool, vector<Coordinate> &pnts, vector<vector<Coordinate> > ssEdges, float radius, float peakTHRg)
 {
 	int i, j;
 	/*
@@ -831,7 +1006,7 @@ void Map::localPeaksMap(vector<Coordinate> &pnts, vector<vector<Coordinate> > ss
 	Coordinate origin;
 	short nAAloop = 10000;
 	cout<<endl<<"Finding local Peaks for the entire map ...";
-	localPeaks (origin, origin, nAAloop, pnts, peakTHRg);		//pnts are stored in XYZ system
+	localPeaks (pool, origin, origin, nAAloop, pnts, peakTHRg);		//pnts are stored in XYZ system
 	cout<<" Done."<<endl;
 
 
@@ -871,183 +1046,181 @@ void Map::filterize(float threshold)
 {
     cout<<"Filtering the map ..."<<endl<<endl;
 
-	int iRow, iCol, iDepth;
-
-	for (iRow=0; iRow<numRows(); iRow++)
-		for (iCol=0; iCol<numCols(); iCol++)
-			for(iDepth=0; iDepth<numSlcs(); iDepth++)
-				if (cube[iRow][iCol][iDepth] < threshold)
-					cube[iRow][iCol][iDepth] = 0.0;
+	ThreadPool pool;
+	process(VoxelPipeline().filter(threshold), pool);
 }
 ////////////////////////////////////////////////////////////////////////////////////
 void Map::normalize()
 {
     cout<<"Normalizing the map ..."<<endl<<endl;
 
-	int iRow, iCol, iDepth;
-
-	for (iRow=0; iRow<numRows(); iRow++)
-		for (iCol=0; iCol<numCols(); iCol++)
-			for(iDepth=0; iDepth<numSlcs(); iDepth++)
-            {
-                cube[iRow][iCol][iDepth] = cube[iRow][iCol][iDepth]/hdr.amax;
-            }
-
+	ThreadPool pool;
+	process(VoxelPipeline().divide(hdr.amax), pool);
+}
+////////////////////////////////////////////////////////////////////////////////////
+// chained steps, ex. normalize then filterize, go over the grid once and gather the stats on the way
+DensityStats Map::process(const VoxelPipeline &steps, ThreadPool &pool)
+{
+	return steps.run(cube, pool);
 }
 ////////////////////////////////////////////////////////////////////////////////////
-short Map::numRows ()
+short Map::numRows () const
 {
-	return 	cube.size();
+	return 	cube.numRows();
 }
 ////////////////////////////////////////////////////////////////////////////////////
-short Map::numCols()
+short Map::numCols() const
 {
-	if (cube.size ())
-		return cube[0].size();
-	else
-		return 0;
+	return cube.numCols();
 }
 ////////////////////////////////////////////////////////////////////////////////////
-short Map::numSlcs()
+short Map::numSlcs() const
 {
-	if (cube.size ())
-		return cube[0][0].size();
-	else
-		return 0;
+	return cube.numSlcs();
 }
 ////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////Added by Dong Si below///////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////
+// 7 tap Gaussian used by gauss_smooth and to smooth the structure tensor
+const float gaussWeights[7]={0.006, 0.061, 0.242, 0.383, 0.242, 0.061, 0.006};
+
 // smoothing the mrc using Gaussian filter
 void Map::gauss_smooth()
+{
+    ThreadPool pool;
+    gauss_smooth(pool, SeparableFilter(gaussWeights, 7));
+}
+
+void Map::gauss_smooth(ThreadPool &pool, const SeparableFilter &filter, BorderPolicy border)
 {
     cout<<"Gauss smoothing the map..."<<endl<<endl;
 
-    int t;
-
-    float wt[7]={0.006, 0.061, 0.242, 0.383, 0.242, 0.061, 0.006};
-
-    // Convolving along x direction
-    for (int k=3; k<numSlcs()-3; k++)
-        for (int j=3; j<numCols()-3; j++)
-            for (int i=3; i<numRows()-3; i++)
-	        {
-	            float temp=0;
-	            for (t=-3; t<=3; t++)
-                     temp += cube[i+t][j][k]*wt[t+3];
-
-	            cube[i][j][k]=temp;
-	        }
-
-    // Convolving along y direction
-    for (int k=3; k<numSlcs()-3; k++)
-        for (int j=3; j<numCols()-3; j++)
-            for (int i=3; i<numRows()-3; i++)
-	        {
-	            float temp=0;
-	            for (t=-3; t<=3; t++)
-                     temp += cube[i][j+t][k]*wt[t+3];
-
-	            cube[i][j][k]=temp;
-	        }
-
-    // Convolving along z direction
-    for (int k=3; k<numSlcs()-3; k++)
-        for (int j=3; j<numCols()-3; j++)
-            for (int i=3; i<numRows()-3; i++)
-	        {
-	            float temp=0;
-                for (t=-3; t<=3; t++)
-                    temp += cube[i][j][k+t]*wt[t+3];
-
-	            cube[i][j][k]=temp;
-	        }
-
-    update_hdrInfo();
+    filter.apply(cube, pool, border);
+
+    update_hdrInfo(process(VoxelPipeline(), pool));
 }
 ////////////////////////////////////////////////////////////////////////////////////
 //update the header info after modify the density map (ex. gauss)
-//update max, min, mean density value --- amin, amax, amean
+//update max, min, mean density value and rms deviation --- amin, amax, amean, rms
 void Map::update_hdrInfo()
 {
-    cout<<"Updating the map header ..."<<endl<<endl;
-
-    float max=-999, min=999, mean=0;
-
-    for (int k=0; k<numSlcs(); k++)
-       for (int j=0; j<numCols(); j++)
-          for (int i=0; i<numRows(); i++)
-          {
-              if (cube[i][j][k] > max)
-                  max = cube[i][j][k];
-              if (cube[i][j][k] < min)
-                  min = cube[i][j][k];
+    ThreadPool pool;
+    update_hdrInfo(process(VoxelPipeline(), pool));
+}
 
-              mean += cube[i][j][k];
-          }
+void Map::update_hdrInfo(const DensityStats &stats)
+{
+    cout<<"Updating the map header ..."<<endl<<endl;
 
-          hdr.amax = max;
-          hdr.amin = min;
-          hdr.amean = float (mean/(numSlcs()*numCols()*numRows()));
+    hdr.amax = stats.amax;
+    hdr.amin = stats.amin;
+    hdr.amean = float (stats.mean());
+    hdr.rms = float (stats.rms());
 }
 ////////////////////////////////////////////////////////////////////////////////////
-// calculate the gradient by using Sobel-like convolution masks
-// when fast=0, use 3D matrix to find the gradient; when fast=1, use two neighbors to find the gradient
-void Map::buildGradient(int fast)
+//close to Sobel
+struct GradientMasks
 {
-    //resize the gradient vector
+    float mx[3][3][3];
+    float my[3][3][3];
+    float mz[3][3][3];
 
-    grad.resize(numRows());			//resize rows
+    GradientMasks()
+    {
+        // setup derivative masks
+        for (int i=0;i<3;i++) {
+           for (int j=0;j<3;j++) {
+              for (int k=0;k<3;k++) {
+                  mx[i][j][k]=0;
+                  my[i][j][k]=0;
+                  mz[i][j][k]=0;
+              }
+           }
+        }
 
-	for(int i=0; i<numRows(); i++){
-		grad[i].resize(numCols());		// resize cols
+        for (int i=0;i<3;i++) {
+            for (int j=0;j<3;j++) {
+                float val=2.0;
+                if (i% 2+j %2 ==0) val=1.0;  //modified by Y. Lu
+                if (i==1 && j ==1 ) val=4.0;
 
-		for (int j=0; j<numCols(); j++)
-			grad[i][j].resize(numSlcs());	//resize depth
-	}
+                //pattern
+                // 121
+                // 242
+                // 121
 
+                mx[0][i][j]=val;
+                mx[2][i][j]=-val;
 
-    float globalmaxda=-999;  //global max gradient value
-    float globalminda=999;  //global min gradient value
+                my[i][0][j]=val;
+                my[i][2][j]=-val;
 
-    //close to Sobel
-    float mx[3][3][3];
-    float my[3][3][3];
-    float mz[3][3][3];
+                mz[i][j][0]=val;
+                mz[i][j][2]=-val;
 
-    // setup derivative masks
-    for (int i=0;i<3;i++) {
-       for (int j=0;j<3;j++) {
-          for (int k=0;k<3;k++) {
-              mx[i][j][k]=0;
-              my[i][j][k]=0;
-              mz[i][j][k]=0;
-          }
-       }
+            }
+        }
     }
+};
 
-    for (int i=0;i<3;i++) {
-        for (int j=0;j<3;j++) {
-            float val=2.0;
-            if (i% 2+j %2 ==0) val=1.0;  //modified by Y. Lu
-            if (i==1 && j ==1 ) val=4.0;
+// gradient of one voxel that is not on the border, cube is anything with cube(i, j, k)
+// when fast=0, use 3D matrix to find the gradient; when fast=1, use two neighbors to find the gradient
+template <typename Cube>
+void voxelGradient(const Cube &cube, int i, int j, int k, int fast, const GradientMasks &m, Gradient &g)
+{
+     if (fast)
+     {
+         g.dx=cube(i-1, j, k)-cube(i+1, j, k);
+         g.dy=cube(i, j-1, k)-cube(i, j+1, k);
+         g.dz=cube(i, j, k-1)-cube(i, j, k+1);
+     }
+     else
+     {
+         g.dx=0;
+         g.dy=0;
+         g.dz=0;
+
+         for (int l=-1;l<2;l++)
+             for (int n=-1;n<2;n++)
+                 for (int o=-1;o<2;o++)
+                 {
+                      g.dx+=m.mx[l+1][n+1][o+1]*cube(i+l, j+n, k+o);
+                      g.dy+=m.my[l+1][n+1][o+1]*cube(i+l, j+n, k+o);
+                      g.dz+=m.mz[l+1][n+1][o+1]*cube(i+l, j+n, k+o);
+                 }
+     }
 
-            //pattern
-            // 121
-            // 242
-            // 121
+     //modified by Dong///////////////////
+     g.dx = -g.dx;
+     g.dy = -g.dy;
+     g.dz = -g.dz;
+     /////////////////////////////////////
 
-            mx[0][i][j]=val;
-            mx[2][i][j]=-val;
+     g.da=sqrt(pow(g.dx,2)+
+               pow(g.dy,2)+
+               pow(g.dz,2));
 
-            my[i][0][j]=val;
-            my[i][2][j]=-val;
+    if (g.da!=0)
+    {
+     g.dx/=g.da;
+     g.dy/=g.da;
+     g.dz/=g.da;
+    }
+}
 
-            mz[i][j][0]=val;
-            mz[i][j][2]=-val;
+// calculate the gradient by using Sobel-like convolution masks
+// when fast=0, use 3D matrix to find the gradient; when fast=1, use two neighbors to find the gradient
+void Map::buildGradient(int fast)
+{
+    //resize the gradient vector
 
-        }
-    }
+    grad.resize(numRows(), numCols(), numSlcs());
+
+
+    float globalmaxda=-999;  //global max gradient value
+    float globalminda=999;  //global min gradient value
+
+    GradientMasks masks;
 
 
     cout<<"Building gradient..."<<endl;
@@ -1057,52 +1230,13 @@ void Map::buildGradient(int fast)
        for (int j=1; j<numCols()-1; j++)
           for (int i=1; i<numRows()-1; i++)
           {
-                 //gradient
-                 if (fast)
-                 {
-                     grad[i][j][k].dx=cube[i-1][j][k]-cube[i+1][j][k];
-                     grad[i][j][k].dy=cube[i][j-1][k]-cube[i][j+1][k];
-                     grad[i][j][k].dz=cube[i][j][k-1]-cube[i][j][k+1];
-                     //cout<<grad[i][j][k].dx;
-                 }
-                 else
-                 {
-                     grad[i][j][k].dx=0;
-                     grad[i][j][k].dy=0;
-                     grad[i][j][k].dz=0;
-
-                     for (int l=-1;l<2;l++)
-                         for (int m=-1;m<2;m++)
-                             for (int n=-1;n<2;n++)
-                             {
-                                  grad[i][j][k].dx+=mx[l+1][m+1][n+1]*cube[i+l][j+m][k+n];
-                                  grad[i][j][k].dy+=my[l+1][m+1][n+1]*cube[i+l][j+m][k+n];
-                                  grad[i][j][k].dz+=mz[l+1][m+1][n+1]*cube[i+l][j+m][k+n];
-                             }
-                 }
+                voxelGradient(cube, i, j, k, fast, masks, grad(i, j, k));
 
-                 //modified by Dong///////////////////
-                 grad[i][j][k].dx = -grad[i][j][k].dx;
-                 grad[i][j][k].dy = -grad[i][j][k].dy;
-                 grad[i][j][k].dz = -grad[i][j][k].dz;
-                 /////////////////////////////////////
+                if (globalmaxda<grad(i, j, k).da)
+                    globalmaxda=grad(i, j, k).da;
 
-                 grad[i][j][k].da=sqrt(pow(grad[i][j][k].dx,2)+
-                                       pow(grad[i][j][k].dy,2)+
-                                       pow(grad[i][j][k].dz,2));
-
-                if (grad[i][j][k].da!=0)
-                {
-                 grad[i][j][k].dx/=grad[i][j][k].da;
-                 grad[i][j][k].dy/=grad[i][j][k].da;
-                 grad[i][j][k].dz/=grad[i][j][k].da;
-                }
-
-                if (globalmaxda<grad[i][j][k].da)
-                    globalmaxda=grad[i][j][k].da;
-
-                if (globalminda>grad[i][j][k].da && cube[i][j][k]!=0)
-                    globalminda=grad[i][j][k].da;
+                if (globalminda>grad(i, j, k).da && cube(i, j, k)!=0)
+                    globalminda=grad(i, j, k).da;
 
           }
 
@@ -1111,503 +1245,350 @@ void Map::buildGradient(int fast)
     cout<<"global min gradient= "<<globalminda<<endl<<endl;
 }
 ////////////////////////////////////////////////////////////////////////////////////
-// Build the structure tensor by using Jacobi method
+// Build the structure tensor and its eigen vectors
 //
 void Map::buildTensor()
+{
+    ThreadPool pool;
+    buildTensor(pool);
+}
+
+void Map::buildTensor(ThreadPool &pool)
 {
     cout<<"Building tensor..."<<endl;
     cout<<endl<<endl;
 
     //resize the tensor vector
 
-    tens.resize(numRows());			//resize rows
-
-	for(int i=0; i<numRows(); i++){
-		tens[i].resize(numCols());		// resize cols
+    tens.resize(numRows(), numCols(), numSlcs());
 
-		for (int j=0; j<numCols(); j++)
-			tens[i][j].resize(numSlcs());	//resize depth
-	}
+    VoxelGrid<SymTensor> H(numRows(), numCols(), numSlcs());
+    int nx = numRows(), ny = numCols(), nz = numSlcs();
 
     /////////////////////////////build Hessian matrix////////////////////////////////////////
-    for (int k=1; k<numSlcs()-1; k++)
-       for (int j=1; j<numCols()-1; j++)
-           for (int i=1; i<numRows()-1; i++)
-           {
-                   vector<float> row0, row1, row2;
-                   float dx2=0.0, dy2=0.0, dz2=0.0, dxdy=0.0, dydz=0.0, dxdz=0.0;
-
-                   dx2 = grad[i][j][k].dx * grad[i][j][k].dx;
-                   dy2 = grad[i][j][k].dy * grad[i][j][k].dy;
-                   dz2 = grad[i][j][k].dz * grad[i][j][k].dz;
-                   dxdy = grad[i][j][k].dx * grad[i][j][k].dy;
-                   dydz = grad[i][j][k].dy * grad[i][j][k].dz;
-                   dxdz = grad[i][j][k].dx * grad[i][j][k].dz;
-
-                   row0.push_back(dx2);
-                   row0.push_back(dxdy);
-                   row0.push_back(dxdz);
-                   row1.push_back(dxdy);
-                   row1.push_back(dy2);
-                   row1.push_back(dydz);
-                   row2.push_back(dxdz);
-                   row2.push_back(dydz);
-                   row2.push_back(dz2);
-
-
-                   tens[i][j][k].Hmatrix.resize(3);
-                   for (int n=0; n<3; n++)
-                        tens[i][j][k].Hmatrix[n].resize(3);
-
-                   tens[i][j][k].Hmatrix[0]=row0;
-                   tens[i][j][k].Hmatrix[1]=row1;
-                   tens[i][j][k].Hmatrix[2]=row2;
-           }
-
-    float wt[7]={0.006, 0.061, 0.242, 0.383, 0.242, 0.061, 0.006};   //gauss convolution mask window
-
-    //Convolving along x direction
-    for (int k=4; k<numSlcs()-4; k++)
-       for (int j=4; j<numCols()-4; j++)
-           for (int i=4; i<numRows()-4; i++)
-           {
-                for (int m=0; m<3; m++)
-                    for (int n=0; n<3; n++)
-                    {
-                        float temp=0.0;
-
-                        for (int t=-3; t<=3; t++)
-                        {
-                            temp += tens[i+t][j][k].Hmatrix[m][n]*wt[t+3];
-                        }
-
-                        tens[i][j][k].Hmatrix[m][n]=temp;
-                    }
-           }
-
-    //Convolving along y direction
-    for (int k=4; k<numSlcs()-4; k++)
-       for (int j=4; j<numCols()-4; j++)
-           for (int i=4; i<numRows()-4; i++)
-           {
-                for (int m=0; m<3; m++)
-                    for (int n=0; n<3; n++)
-                    {
-                        float temp=0.0;
-
-                        for (int t=-3; t<=3; t++)
-                        {
-                            temp += tens[i][j+t][k].Hmatrix[m][n]*wt[t+3];
-                        }
-
-                        tens[i][j][k].Hmatrix[m][n]=temp;
-                    }
-           }
-
-    //Convolving along z direction
-    for (int k=4; k<numSlcs()-4; k++)
-       for (int j=4; j<numCols()-4; j++)
-           for (int i=4; i<numRows()-4; i++)
-           {
-                for (int m=0; m<3; m++)
-                    for (int n=0; n<3; n++)
-                    {
-                        float temp=0.0;
-
-                        for (int t=-3; t<=3; t++)
-                        {
-                            temp += tens[i][j][k+t].Hmatrix[m][n]*wt[t+3];
-                        }
-
-                        //Store the new result in the Hmatrix entry
-                        tens[i][j][k].Hmatrix[m][n] = temp;
-                    }
-           }
-
+    pool.parallelFor(nz, [&](int k)
+    {
+        if (k < 1 || k >= nz-1)
+            return;
+        for (int j=1; j<ny-1; j++)
+            for (int i=1; i<nx-1; i++)
+                H(i, j, k) = SymTensor::outer(grad(i, j, k).dx, grad(i, j, k).dy, grad(i, j, k).dz);
+    });
 
-    for (int k=4; k<numSlcs()-4; k++)
-       for (int j=4; j<numCols()-4; j++)
-           for (int i=4; i<numRows()-4; i++)
-           {
-              if (cube[i][j][k]>0.0)
-              {
-                Jacobi J;
+    //gauss convolution mask window, the voxels within 4 of the edge are kept
+    SeparableFilter(gaussWeights, 7).apply(H, pool, BORDER_KEEP, 4);
 
-                J.matrix.resize(3);
-                for (int n=0; n<3; n++)
-                     J.matrix[n].resize(3);
+    pool.parallelFor(nz, [&](int k)
+    {
+        for (int j=0; j<ny; j++)
+            for (int i=0; i<nx; i++)
+            {
+                Tensor &T = tens(i, j, k);
+                T.Hmatrix = H(i, j, k);
 
-                J.matrix = tens[i][j][k].Hmatrix;
-                J.dimen = 3;
-                J.eigenvalues.resize(J.dimen);
-                J.eigenvectors.resize(J.dimen);
-                J.e = 1e-8;
-                J.jacobi();
+                if (i<4 || j<4 || k<4 || i>=nx-4 || j>=ny-4 || k>=nz-4 || !(cube(i, j, k)>0.0))
+                    continue;
 
-                tens[i][j][k].Evalue.resize(3);
-                tens[i][j][k].Evector.resize(3);
+                SymEigen E(T.Hmatrix);
                 for (int n=0; n<3; n++)
-                     tens[i][j][k].Evector[n].resize(3);
-
-                tens[i][j][k].Evalue = J.getEigenvalues();
-                tens[i][j][k].Evector = J.getEigenvectors();
-              }
-           }
+                {
+                    T.Evalue[n] = E.values[n];
+                    for (int c=0; c<3; c++)
+                        T.Evector[n][c] = E.vectors[n][c];
+                }
+            }
+    });
 
 
     cout<<"Done the tensor building!"<<endl;
     cout<<endl<<endl;
 }
 ////////////////////////////////////////////////////////////////////////////////////
+// Length of the ray from the centre of voxel (i, j, k) along dir (in voxels) to the first voxel at or
+// below threshold, or outside lo .. hi on any axis, in units of the ray parameter; 0 when the start
+// voxel is below threshold already. The ray walks from voxel to voxel as in Amanatides and Woo,
+// "A Fast Voxel Traversal Algorithm for Ray Tracing", so every voxel it passes through is looked at
+// once, and the length is taken where it enters the stopping voxel. With maxT > 0 the ray stops there.
+float rayLength(const VoxelGrid<vxlDataType> &cube, int i, int j, int k, const float dir[3], float threshold, const int lo[3], const int hi[3], float maxT)
+{
+    const vxlDataType* v = &cube(i, j, k);
+    if (*v <= threshold)
+        return 0;
+
+    int cell[3] = {i, j, k};
+    int stride[3] = {1, cube.strideY(), cube.strideZ()};
+    int left[3];                    // voxels the ray can still move on each axis before it leaves lo .. hi
+    float tMax[3], tDelta[3];       // ray parameter at the next boundary on each axis, and between two boundaries
+    for (int a = 0; a < 3; a++)
+    {
+        left[a] = dir[a] > 0 ? hi[a] - cell[a] : cell[a] - lo[a];
+        if (dir[a] < 0)
+            stride[a] = -stride[a];
+        tDelta[a] = dir[a] != 0 ? 1/fabs(dir[a]) : HUGE_VALF;
+        tMax[a] = tDelta[a]/2;
+    }
+    float tEnd = maxT > 0 ? maxT : HUGE_VALF;
+
+    //the axis to step on is picked with masks rather than branches, which the ray direction makes hard to predict
+    while (true)
+    {
+        int m0 = tMax[0] <= tMax[1] && tMax[0] <= tMax[2];
+        int m1 = !m0 && tMax[1] <= tMax[2];
+        int m2 = !m0 && !m1;
+        float t = min(tMax[0], min(tMax[1], tMax[2]));
+        if (t >= tEnd)      //also a ray with no direction, which never leaves its voxel
+            return maxT;
+        left[0] -= m0;
+        left[1] -= m1;
+        left[2] -= m2;
+        if ((left[0] | left[1] | left[2]) < 0)
+            return t;
+        v += m0*stride[0] + m1*stride[1] + m2*stride[2];
+        tMax[0] += m0 ? tDelta[0] : 0;
+        tMax[1] += m1 ? tDelta[1] : 0;
+        tMax[2] += m2 ? tDelta[2] : 0;
+        if (*v <= threshold)
+            return t;
+    }
+}
+////////////////////////////////////////////////////////////////////////////////////
+void Map::buildThickness(float threshold)
+{
+    ThreadPool pool;
+    buildThickness(pool, threshold);
+}
+
 // Build the structure thickness by traveling along the eigen vector direction
 //
-void Map::buildThickness(float threshold)
+// For every voxel above 0 inside the 4 voxel border, t1, t2 and t3 are the lengths (in A) of the
+// chord through it along Evector[0], [1] and [2]: a ray each way to the first voxel at or below
+// threshold or outside the border (see rayLength). A ray is cut at maxLength A when that is above 0.
+// Slices are split between the threads of pool.
+void Map::buildThickness(ThreadPool &pool, float threshold, float maxLength)
 {
     setApix();
 
-    //resize the thickness vector
-    thick.resize(numRows());			//resize rows
-
-	for(int i=0; i<numRows(); i++){
-		thick[i].resize(numCols());		// resize cols
+    int nx = numRows(), ny = numCols(), nz = numSlcs();
 
-		for (int j=0; j<numCols(); j++)
-			thick[i][j].resize(numSlcs());	//resize depth
-	}
+    //resize the thickness vector
+    thick.resize(nx, ny, nz);
 
     cout<<"Building thickness..."<<endl;
     cout<<endl<<endl;
 
+    const int lo[3] = {4, 4, 4};
+    const int hi[3] = {nx-4, ny-4, nz-4};
+    int chunks = pool.size();
 
-    for (int k=4; k<numSlcs()-4; k++)
-       for (int j=4; j<numCols()-4; j++)
-           for (int i=4; i<numRows()-4; i++)
-           {
-              if (cube[i][j][k]>0.0)
-              {
-               //Evectors
-               vector<float> v1(tens[i][j][k].Evector[0]);
-               vector<float> v2(tens[i][j][k].Evector[1]);
-               vector<float> v3(tens[i][j][k].Evector[2]);
-
-
+    pool.parallelFor(chunks, [&](int c)
+    {
+        for (int k = max(c*nz/chunks, 4); k < min((c+1)*nz/chunks, nz-4); k++)
+            for (int j=4; j<ny-4; j++)
+                for (int i=4; i<nx-4; i++)
+                {
+                    if (!(cube(i, j, k)>0.0))
+                        continue;
 
-               // t1, goes along Evector direction
-               int n=0;
-               float temp=0; // temp distance
-               while (true)
-               {
-                    if (i+int(n*v1[0])>numRows()-4 || j+int(n*v1[1])>numCols()-4 || k+int(n*v1[2])>numSlcs()-4 \
-                        || i+int(n*v1[0])<4 || j+int(n*v1[1])<4 || k+int(n*v1[2])<4)
-                        {
-                            temp = sqrt(pow(n*v1[0]*apixX,2)+pow(n*v1[1]*apixY,2)+pow(n*v1[2]*apixZ,2));
-                            break;
-                        }
-                    else if (cube[i+int(n*v1[0])][j+int(n*v1[1])][k+int(n*v1[2])]<=threshold)
-                    {
-                        temp = sqrt(pow(n*v1[0]*apixX,2)+pow(n*v1[1]*apixY,2)+pow(n*v1[2]*apixZ,2));
-                        break;
-                    }
-                    n++;
-               }
-               thick[i][j][k].t1 += temp;
-
-               // goes along oppsite direction
-               n=0;
-               temp=0;
-               while (true)
-               {
-                    if (i+int(n*-v1[0])>numRows()-4 || j+int(n*-v1[1])>numCols()-4 || k+int(n*-v1[2])>numSlcs()-4 \
-                        || i+int(n*-v1[0])<4 || j+int(n*-v1[1])<4 || k+int(n*-v1[2])<4)
-                        {
-                            temp = sqrt(pow(n*-v1[0]*apixX,2)+pow(n*-v1[1]*apixY,2)+pow(n*-v1[2]*apixZ,2));
-                            break;
-                        }
-                    else if (cube[i+int(n*-v1[0])][j+int(n*-v1[1])][k+int(n*-v1[2])]<=threshold)
-                    {
-                        temp = sqrt(pow(n*-v1[0]*apixX,2)+pow(n*-v1[1]*apixY,2)+pow(n*-v1[2]*apixZ,2));
-                        break;
-                    }
-                    n++;
-               }
-               thick[i][j][k].t1 += temp;
-
-
-               // t2
-               n=0;
-               temp=0;
-               while (true)
-               {
-                    if (i+int(n*v2[0])>numRows()-4 || j+int(n*v2[1])>numCols()-4 || k+int(n*v2[2])>numSlcs()-4 \
-                        || i+int(n*v2[0])<4 || j+int(n*v2[1])<4 || k+int(n*v2[2])<4)
-                        {
-                            temp = sqrt(pow(n*v2[0]*apixX,2)+pow(n*v2[1]*apixY,2)+pow(n*v2[2]*apixZ,2));
-                            break;
-                        }
-                    else if (cube[i+int(n*v2[0])][j+int(n*v2[1])][k+int(n*v2[2])]<=threshold)
+                    float* t[3] = {&thick(i, j, k).t1, &thick(i, j, k).t2, &thick(i, j, k).t3};
+                    for (int e = 0; e < 3; e++)
                     {
-                        temp = sqrt(pow(n*v2[0]*apixX,2)+pow(n*v2[1]*apixY,2)+pow(n*v2[2]*apixZ,2));
-                        break;
-                    }
-                    n++;
-               }
-               thick[i][j][k].t2 += temp;
-
-               n=0;
-               temp=0;
-               while (true)
-               {
-                    if (i+int(n*-v2[0])>numRows()-4 || j+int(n*-v2[1])>numCols()-4 || k+int(n*-v2[2])>numSlcs()-4 \
-                        || i+int(n*-v2[0])<4 || j+int(n*-v2[1])<4 || k+int(n*-v2[2])<4)
-                        {
-                            temp = sqrt(pow(n*-v2[0]*apixX,2)+pow(n*-v2[1]*apixY,2)+pow(n*-v2[2]*apixZ,2));
-                            break;
-                        }
-                    else if (cube[i+int(n*-v2[0])][j+int(n*-v2[1])][k+int(n*-v2[2])]<=threshold)
-                    {
-                        temp = sqrt(pow(n*-v2[0]*apixX,2)+pow(n*-v2[1]*apixY,2)+pow(n*-v2[2]*apixZ,2));
-                        break;
-                    }
-                    n++;
-               }
-               thick[i][j][k].t2 += temp;
-
-
-               // t3
-               n=0;
-               temp=0;
-               while (true)
-               {
-                    if (i+int(n*v3[0])>numRows()-4 || j+int(n*v3[1])>numCols()-4 || k+int(n*v3[2])>numSlcs()-4 \
-                        || i+int(n*v3[0])<4 || j+int(n*v3[1])<4 || k+int(n*v3[2])<4)
-                        {
-                            temp = sqrt(pow(n*v3[0]*apixX,2)+pow(n*v3[1]*apixY,2)+pow(n*v3[2]*apixZ,2));
-                            break;
-                        }
-                    else if (cube[i+int(n*v3[0])][j+int(n*v3[1])][k+int(n*v3[2])]<=threshold)
-                    {
-                        temp = sqrt(pow(n*v3[0]*apixX,2)+pow(n*v3[1]*apixY,2)+pow(n*v3[2]*apixZ,2));
-                        break;
-                    }
-                    n++;
-               }
-               thick[i][j][k].t3 += temp;
-
-               n=0;
-               temp=0;
-               while (true)
-               {
-                    if (i+int(n*-v3[0])>numRows()-4 || j+int(n*-v3[1])>numCols()-4 || k+int(n*-v3[2])>numSlcs()-4 \
-                        || i+int(n*-v3[0])<4 || j+int(n*-v3[1])<4 || k+int(n*-v3[2])<4)
-                        {
-                            temp = sqrt(pow(n*-v3[0]*apixX,2)+pow(n*-v3[1]*apixY,2)+pow(n*-v3[2]*apixZ,2));
-                            break;
-                        }
-                    else if (cube[i+int(n*-v3[0])][j+int(n*-v3[1])][k+int(n*-v3[2])]<=threshold)
-                    {
-                        temp = sqrt(pow(n*-v3[0]*apixX,2)+pow(n*-v3[1]*apixY,2)+pow(n*-v3[2]*apixZ,2));
-                        break;
-                    }
-                    n++;
-               }
-               thick[i][j][k].t3 += temp;
+                        const float* v = tens(i, j, k).Evector[e];
+                        float forward[3] = {v[0], v[1], v[2]};
+                        float backward[3] = {-v[0], -v[1], -v[2]};
 
-               //cout<<thick[i][j][k].t1<<" "<<thick[i][j][k].t2<<" "<<thick[i][j][k].t3<<endl<<endl;
-              }
-           }
+                        //A per unit of the ray parameter
+                        float scale = sqrt(pow(v[0]*apixX,2)+pow(v[1]*apixY,2)+pow(v[2]*apixZ,2));
+                        float maxT = maxLength > 0 && scale > 0 ? maxLength/scale : 0;
 
+                        *t[e] += rayLength(cube, i, j, k, forward, threshold, lo, hi, maxT) * scale;
+                        *t[e] += rayLength(cube, i, j, k, backward, threshold, lo, hi, maxT) * scale;
+                    }
+                }
+    });
 
     cout<<"Done the thickness building!"<<endl;
     cout<<endl<<endl;
 }
 ////////////////////////////////////////////////////////////////////////////////////
-// Saito-Toriwaki algorithm for Euclidian Distance Transformation.
+// One line of the separable distance transform (Meijster, Roerdink and Hesselink):
+// d[u] = min over i of f[i] + (u-i)^2, capped at cap, in linear time from the lower envelope of the
+// parabolas. s and t are scratch of n ints each, d must not be f.
+void distanceLine(const int* f, int n, int* d, int cap, int* s, int* t)
+{
+    int q = 0;
+    s[0] = 0;
+    t[0] = 0;
+    for (int u = 1; u < n; u++)
+    {
+        while (q >= 0 && (t[q]-s[q])*(t[q]-s[q]) + f[s[q]] > (t[q]-u)*(t[q]-u) + f[u])
+            q--;
+        if (q < 0)
+        {
+            q = 0;
+            s[0] = u;
+        }
+        else
+        {
+            // first point where parabola u is below parabola s[q], rounding down
+            int num = u*u - s[q]*s[q] + f[u] - f[s[q]];
+            int den = 2*(u - s[q]);
+            int w = 1 + (num >= 0 ? num/den : -((den - 1 - num)/den));
+            if (w < n)
+            {
+                q++;
+                s[q] = u;
+                t[q] = w;
+            }
+        }
+    }
+
+    for (int u = n-1; u >= 0; u--)
+    {
+        d[u] = min((u-s[q])*(u-s[q]) + f[s[q]], cap);
+        if (u == t[q])
+            q--;
+    }
+}
+
+void Map::EDT()
+{
+    ThreadPool pool;
+    EDT(pool);
+}
+
+// Euclidian Distance Transformation
 // Computing Local Thickness of 3D Structures with ImageJ - Robert P. Dougherty and Karl-Heinz Kunzelmann
 //
-void Map::EDT()
+// Squared distances are built one axis at a time in one int grid: along x by a scan each way, then
+// along y and z as lower envelopes of parabolas, so every pass is linear in the number of voxels.
+// Lines are split between the threads of pool, each with its own scratch lines.
+// Gives the same dt as the former brute force Saito-Toriwaki passes, including their cap for lines
+// without any background.
+void Map::EDT(ThreadPool &pool)
 {
     cout<<"Euclidian Distance Transform..."<<endl;
     cout<<endl<<endl;
 
-    //resize the DT vector
-    dt.resize(numRows());			//resize rows
-	for(int i=0; i<numRows(); i++)
-	{
-		dt[i].resize(numCols());		// resize cols
-		for (int j=0; j<numCols(); j++)
-			dt[i][j].resize(numSlcs());	//resize depth
-	}
-
-	// temp pictures
-	vector<vector<vector<int> > >   f;    // temp picture F
-    //resize the f vector
-    f.resize(numRows());			//resize rows
-	for(int i=0; i<numRows(); i++)
-	{
-		f[i].resize(numCols());		// resize cols
-		for (int j=0; j<numCols(); j++)
-			f[i][j].resize(numSlcs());	//resize depth
-	}
-
-	vector<vector<vector<int> > >   g;    // temp picture G
-    //resize the g vector
-    g.resize(numRows());			//resize rows
-	for(int i=0; i<numRows(); i++)
-	{
-		g[i].resize(numCols());		// resize cols
-		for (int j=0; j<numCols(); j++)
-			g[i][j].resize(numSlcs());	//resize depth
-	}
-
-	vector<vector<vector<int> > >   h;    // temp picture H
-    //resize the h vector
-    h.resize(numRows());			//resize rows
-	for(int i=0; i<numRows(); i++)
-	{
-		h[i].resize(numCols());		// resize cols
-		for (int j=0; j<numCols(); j++)
-			h[i][j].resize(numSlcs());	//resize depth
-	}
+    int nx = numRows(), ny = numCols(), nz = numSlcs();
 
+    //resize the DT vector
+    dt.resize(nx, ny, nz);
 
-	// make object voxels to 1, background 0
-    for (int k=0; k<numSlcs(); k++)
-       for (int j=0; j<numCols(); j++)
-           for (int i=0; i<numRows(); i++)
-           {
-              if (cube[i][j][k]>0.0)
-                  f[i][j][k] = 1;
-              else
-                  f[i][j][k] = 0;
-           }
+    VoxelGrid<int> sq(nx, ny, nz);      // squared distance to the background so far
 
-    int n = numRows();
-    if(numCols() > n) n = numCols();
-    if(numSlcs() > n) n = numSlcs();
+    int n = nx;
+    if(ny > n) n = ny;
+    if(nz > n) n = nz;
     int noResult = 3*(n+1)*(n+1);
 
-    // tansform 1, get G from F
-    for (int k=0; k<numSlcs(); k++)
-       for (int j=0; j<numCols(); j++)
-          for (int i=0; i<numRows(); i++)
-          {
-              int min = noResult;
-              for (int x = i; x < numRows(); x++)
-              {
-                  if (f[x][j][k] == 0) // reach the background
-                  {
-                      if (pow((double)i-x,2)<min)
-                      {
-                          min = pow((double)i-x,2);
-                      }
-                      break;
-                  }
-              }
-              for (int x = i-1; x >=0 ; x--)
-              {
-                  if (f[x][j][k] == 0)
-                  {
-                      if (pow((double)i-x,2)<min)
-                      {
-                          min = pow((double)i-x,2);
-                      }
-                      break;
-                  }
-              }
-
-              g[i][j][k] = min;
-          }
+    int chunks = pool.size();
 
+    // tansform 1, along x: distance to the closest background voxel (cube <= 0) in the row
+    pool.parallelFor(chunks, [&](int c)
+    {
+        for (int k = c*nz/chunks; k < (c+1)*nz/chunks; k++)
+            for (int j = 0; j < ny; j++)
+            {
+                const vxlDataType* v = &cube(0, j, k);
+                int* g = &sq(0, j, k);
 
-    // tansform 2, get H from G
-    for (int k=0; k<numSlcs(); k++)
-       for (int i=0; i<numRows(); i++)
-          for (int j=0; j<numCols(); j++)
-          {
-              bool nonempty = false;
-              if (g[i][j][k] > 0)
-                  nonempty = true;
-
-              if (nonempty)
-              {
-                  int min = noResult;
-                  for (int y=0; y<numCols(); y++)
-                  {
-                      if (g[i][y][k] + pow((double)j-y,2) < min)
-                      {
-                          min = g[i][y][k] + pow((double)j-y,2);
-                      }
-                  }
-
-                  h[i][j][k] = min;
-              }
-          }
+                int last = -1;
+                for (int i = 0; i < nx; i++)
+                {
+                    if (!(v[i] > 0.0))
+                        last = i;
+                    g[i] = last < 0 ? noResult : (i-last)*(i-last);
+                }
+                last = -1;
+                for (int i = nx-1; i >= 0; i--)
+                {
+                    if (!(v[i] > 0.0))
+                        last = i;
+                    if (last >= 0 && (last-i)*(last-i) < g[i])
+                        g[i] = (last-i)*(last-i);
+                }
+            }
+    });
 
+    // tansform 2, along y
+    pool.parallelFor(chunks, [&](int c)
+    {
+        vector<int> f(ny), d(ny), s(ny), t(ny);
+        for (int k = c*nz/chunks; k < (c+1)*nz/chunks; k++)
+            for (int i = 0; i < nx; i++)
+            {
+                int* line = &sq(i, 0, k);
+                for (int j = 0; j < ny; j++)
+                    f[j] = line[j*nx];
+                distanceLine(f.data(), ny, d.data(), noResult, s.data(), t.data());
+                for (int j = 0; j < ny; j++)
+                    line[j*nx] = d[j];
+            }
+    });
 
-    // tansform 3, get S from H
-    for (int j=0; j<numCols(); j++)
-       for (int i=0; i<numRows(); i++)
-          for (int k=0; k<numSlcs(); k++)
-          {
-              bool nonempty = false;
-              if (h[i][j][k] > 0)
-                  nonempty = true;
-
-              if (nonempty)
-              {
-                  int min = noResult;
-                  for (int z=0; z<numSlcs(); z++)
-                  {
-                      if (h[i][j][z] + pow((double)k-z,2) < min)
-                      {
-                          min = h[i][j][z] + pow((double)k-z,2);
-                      }
-                  }
-
-                  dt[i][j][k] = sqrt(min);   // s = dt^2
-              }
-          }
+    // tansform 3, along z
+    pool.parallelFor(chunks, [&](int c)
+    {
+        vector<int> f(nz), d(nz), s(nz), t(nz);
+        size_t strideZ = (size_t)nx*ny;
+        for (int j = c*ny/chunks; j < (c+1)*ny/chunks; j++)
+            for (int i = 0; i < nx; i++)
+            {
+                const int* line = &sq(i, j, 0);
+                for (int k = 0; k < nz; k++)
+                    f[k] = line[k*strideZ];
+                distanceLine(f.data(), nz, d.data(), noResult, s.data(), t.data());
+                float* out = &dt(i, j, 0);
+                for (int k = 0; k < nz; k++)
+                    out[k*strideZ] = sqrt(d[k]);   // s = dt^2
+            }
+    });
 }
 ////////////////////////////////////////////////////////////////////////////////////
+void Map::DR()
+{
+    ThreadPool pool;
+    DR(pool);
+}
+
 // detect the distance ridge/medial axis from the distance map
 // "Computing Local Thickness of 3D Structures with ImageJ" - Robert P. Dougherty and Karl-Heinz Kunzelmann
 //
-void Map::DR()
+// A voxel is on the ridge unless the ball of one of its 26 neighbours covers its own, which the
+// templates tell from the squared distances alone. The squared distances are rounded once into an int
+// grid and the neighbours are flat offsets into it: voxels inside the one voxel border check all 26
+// without bounds tests, the border ones only those in the grid. Slices are split between the threads
+// of pool.
+void Map::DR(ThreadPool &pool)
 {
 	cout<<"Find the Distance Ridge from distance map..."<<endl;
 	cout<<endl<<endl;
 
-    //resize the DR vector
-    dr.resize(numRows());			//resize rows
-	for(int i=0; i<numRows(); i++)
-	{
-		dr[i].resize(numCols());		// resize cols
-		for (int j=0; j<numCols(); j++)
-			dr[i][j].resize(numSlcs());	//resize depth
-	}
+    int nx = numRows(), ny = numCols(), nz = numSlcs();
+    int chunks = pool.size();
 
-	//Find the largest distance in the data
-	float distMax = 0;
+    //resize the DR vector
+    dr.resize(nx, ny, nz);
 
-    for (int k=0; k<numSlcs(); k++)
-        for (int j=0; j<numCols(); j++)
-            for (int i=0; i<numRows(); i++)
-            {
-                if (dt[i][j][k] > distMax)
-                    distMax = dt[i][j][k];
-            }
+    //squared distances as ints, and the largest one
+    VoxelGrid<int> sq(nx, ny, nz);
+    vector<int> chunkMax(chunks, 0);
+    pool.parallelFor(chunks, [&](int c)
+    {
+        for (size_t n = sq.count()*c/chunks; n < sq.count()*(c+1)/chunks; n++)
+        {
+            sq.at(n) = (int)(pow((double)dt.at(n),2)+0.5);
+            chunkMax[c] = max(chunkMax[c], sq.at(n));
+        }
+    });
 
-	int rSqMax = (int)(pow((double)distMax,2)+0.5) + 1; // maximum d^2
+	int rSqMax = *max_element(chunkMax.begin(), chunkMax.end()) + 1; // maximum d^2
 
 	vector<bool> occurs;  // if rSqMax occurs
 	occurs.resize(rSqMax);
 
-	for (int k=0; k<numSlcs(); k++)
-        for (int j=0; j<numCols(); j++)
-            for (int i=0; i<numRows(); i++)
-            {
-                occurs[(int)(pow((double)dt[i][j][k],2)+0.5)] = true;
-            }
+	for (size_t n = 0; n < sq.count(); n++)
+        occurs[sq.at(n)] = true;
 
     int numRadii = 0;  // number of different r occurs from 0 to d
 
@@ -1633,75 +1614,57 @@ void Map::DR()
         }
     }
 
+    //the template of every radius index in one row, by the number of nonzero components of the offset
     vector<vector<int> > rSqTemplate = createTemplate(distSqValues);
-
-    int numCompZ,numCompY,numCompX,numComp;
-    int k1,j1,i1,dz,dy,dx;
-    bool notRidgePoint;
-    int sk0Sq, sk0SqInd, sk1Sq;
-
-    for (int k=0; k<numSlcs(); k++)
-        for (int j=0; j<numCols(); j++)
-            for (int i=0; i<numRows(); i++)
-            {
-                if (dt[i][j][k]>0)
+    vector<int> limit(3*numRadii);
+    for (int r = 0; r < numRadii; r++)
+        for (int c = 0; c < 3; c++)
+            limit[3*r + c] = rSqTemplate[c][r];
+
+    //the 26 neighbours
+    int offset[26], numComp[26], step[26][3];
+    int numNbr = 0;
+    for (int dz=-1; dz<=1; dz++)
+        for (int dy=-1; dy<=1; dy++)
+            for (int dx=-1; dx<=1; dx++)
+                if (dx != 0 || dy != 0 || dz != 0)
                 {
-                    notRidgePoint = false;
-                    sk0Sq = (int)(pow((double)dt[i][j][k],2)+0.5);
-                    sk0SqInd = distSqIndex[sk0Sq];
+                    offset[numNbr] = dx + nx*(dy + ny*dz);
+                    numComp[numNbr] = abs(dx) + abs(dy) + abs(dz);
+                    step[numNbr][0] = dx;
+                    step[numNbr][1] = dy;
+                    step[numNbr][2] = dz;
+                    numNbr++;
+                }
 
-                    for (dz=-1; dz<=1; dz++)
+    pool.parallelFor(chunks, [&](int c)
+    {
+        for (int k = c*nz/chunks; k < (c+1)*nz/chunks; k++)
+            for (int j = 0; j < ny; j++)
+                for (int i = 0; i < nx; i++)
+                {
+                    size_t v = sq.index(i, j, k);
+                    if (!(dt.at(v) > 0))
+                        continue;
+
+                    const int* sk1Sq = sq.data() + v;
+                    const int* lim = &limit[3*distSqIndex[sq.at(v)]];
+                    bool ridgePoint = true;
+                    if (i > 0 && j > 0 && k > 0 && i < nx-1 && j < ny-1 && k < nz-1)
                     {
-                        k1 = k + dz;
-                        if ((k1>=0) && (k1<numSlcs()))
-                        {
-                            if (dz==0)
-                                numCompZ = 0;
-                            else
-                                numCompZ = 1;
-
-                            for (dy=-1; dy <= 1; dy++)
-                            {
-                                j1 = j + dy;
-                                if ((j1>=0) && (j1<numCols()))
-                                {
-                                    if (dy==0)
-                                        numCompY = 0;
-                                    else
-                                        numCompY = 1;
-
-                                    for (dx=-1; dx<=1; dx++)
-                                    {
-                                        i1 = i + dx;
-                                        if((i1>=0) && (i1<numRows()))
-                                        {
-                                            if (dx == 0)
-                                                numCompX = 0;
-                                            else
-                                                numCompX = 1;
-
-                                            numComp = numCompX + numCompY + numCompZ;
-
-                                            if (numComp>0)
-                                            {
-                                                sk1Sq = (int)(pow((double)dt[i1][j1][k1],2)+0.5);
-
-                                                if (sk1Sq>=rSqTemplate[numComp-1][sk0SqInd])
-                                                    notRidgePoint = true;
-                                            }
-                                        }//if in grid for i1
-                                        if(notRidgePoint)break;
-                                    }//dx
-                                }//if in grid for j1
-                                if(notRidgePoint)break;
-                            }//dy
-                        }//if in grid for k1
-                        if(notRidgePoint)break;
-                    }//dz
-                    if (!notRidgePoint)
-                       dr[i][j][k] = dt[i][j][k];  // save the distance ridge as this voxel's dt
-                }//if in the object
-            }
+                        for (int n = 0; n < 26; n++)
+                            ridgePoint &= sk1Sq[offset[n]] < lim[numComp[n]-1];
+                    }
+                    else
+                    {
+                        for (int n = 0; n < 26; n++)
+                            if (sq.inside(i + step[n][0], j + step[n][1], k + step[n][2]))
+                                ridgePoint &= sk1Sq[offset[n]] < lim[numComp[n]-1];
+                    }
+                    if (ridgePoint)
+                        dr.at(v) = dt.at(v);  // save the distance ridge as this voxel's dt
+                }
+    });
 
     cout<<"Distance Ridge complete!"<<endl;
 }
@@ -1716,12 +1679,8 @@ void Map::DR()
 //
 vector<vector<int > > Map::createTemplate(vector<int> distSqValues)
 {
-    int numRadii = distSqValues.size();
-
     vector<vector<int> > t;
     t.resize(3);
-    for (int i=0; i<3; i++)
-        t.resize(numRadii);
 
     t[0] = scanCube(1,0,0,distSqValues);
     t[1] = scanCube(1,1,0,distSqValues);
@@ -1873,100 +1832,81 @@ float Map::LocalThickness(int x, int y, int z)
  according to their local-peak-count numbers. The top 50% of voxels with highest
  localpeak-count numbers are categorized as backbone voxels, whereas the lowest 50% are discarded. */
 void Map::LocalPeakFilter(int divider)
+{
+    ThreadPool pool;
+    LocalPeakFilter(pool, divider);
+}
+
+void Map::LocalPeakFilter(ThreadPool &pool, int divider)
 {
     setApix();
 
     cout<<"filtering predicted map using LPF..."<<endl<<endl;
 
-    vector<vector<vector<int> > > lpc;  //local-peak-count number for each voxel
+    int nx = numRows(), ny = numCols(), nz = numSlcs();
+    int chunks = pool.size();
 
-    // initialization of the localPeakCount for all voxels
-    lpc.resize(numRows());
-	for(long i=0; i<numRows(); i++)
-	{
-		lpc[i].resize(numCols());
-		for (long j=0; j<numCols(); j++)
-			lpc[i][j].resize(numSlcs());
-	}
+    //the voxels within 3 A, at most 10 voxels away along each axis
+    SphereOffsets sphere(3, apixX, apixY, apixZ, 10, nx, ny);
 
-    // working on each voxel
-    for (long k=0; k<numSlcs(); k++)
-        for (long j=0; j<numCols(); j++)
-            for (long i=0; i<numRows(); i++)
-            {
-                if (cube[i][j][k]>0)
+    // average density of the sphere around each voxel, over its voxels above 0; voxels not above 0
+    // are no centre and get HUGE_VAL, which no density is greater than
+    VoxelGrid<double> averageDensity(nx, ny, nz, HUGE_VAL);
+    pool.parallelFor(chunks, [&](int c)
+    {
+        for (int k = c*nz/chunks; k < (c+1)*nz/chunks; k++)
+            for (int j=0; j<ny; j++)
+                for (int i=0; i<nx; i++)
                 {
-                    Coordinate center; //center of the sphere - corrent voxel
-                    center.x=i*apixX+hdr.xorigin;
-                    center.y=j*apixY+hdr.yorigin;
-                    center.z=k*apixZ+hdr.zorigin;
+                    if (!(cube(i, j, k)>0))
+                        continue;
 
                     double totalDensity=0;  // total density in this sphere
                     double numOfpoints=0;   // total # of voxels in this sphere
-
-                    // looking at the neighbors
-                    for (int n=-10; n<=10; n++)
-                        for (int p=-10; p<=10; p++)
-                            for (int q=-10; q<=10; q++)
-                            {
-                                Coordinate point; //points in the sphere
-                                point.x=(i+n)*apixX+hdr.xorigin;
-                                point.y=(j+p)*apixY+hdr.yorigin;
-                                point.z=(k+q)*apixZ+hdr.zorigin;
-
-                                // if p is in the sphere of 3 A˚ in radius
-                                if (i+n<numRows() && j+p<numCols() && k+q<numSlcs() \
-                                    && i+n>=0 && j+p>=0 && k+q>=0 && getDistance(center,point)<=3 \
-                                    && cube[i+n][j+p][k+q]>0)
-                                    {
-                                        totalDensity+=cube[i+n][j+p][k+q];
-                                        numOfpoints++;
-                                    }
-                            }
-
-                    // average density within this sphere
-                    double averageDensity = (double)totalDensity/numOfpoints;
-
-                    // working on the neighbors
-                    for (int n=-10; n<=10; n++)
-                        for (int p=-10; p<=10; p++)
-                            for (int q=-10; q<=10; q++)
-                            {
-                                Coordinate point; //points in the sphere
-                                point.x=(i+n)*apixX+hdr.xorigin;
-                                point.y=(j+p)*apixY+hdr.yorigin;
-                                point.z=(k+q)*apixZ+hdr.zorigin;
-
-                                // if in the sphere of 3 A˚ in radius
-                                if (i+n<numRows() && j+p<numCols() && k+q<numSlcs() \
-                                    && i+n>=0 && j+p>=0 && k+q>=0 && getDistance(center,point)<=3 \
-                                    && cube[i+n][j+p][k+q]>0)
-                                    {
-                                        if (cube[i+n][j+p][k+q]>averageDensity)
-                                            lpc[i+n][j+p][k+q]++;
-                                    }
-                            }
+                    sphere.forEachInside(i, j, k, nx, ny, nz, [&](long n)
+                    {
+                        if (cube.at(n)>0)
+                        {
+                            totalDensity+=cube.at(n);
+                            numOfpoints++;
+                        }
+                    });
+                    averageDensity(i, j, k) = totalDensity/numOfpoints;
                 }
+    });
+
+    //local-peak-count number for each voxel: the spheres it lies in whose average it is above. The sphere
+    //is symmetric, so these are the centres within the sphere around the voxel itself, and every voxel
+    //counts its own without the threads writing to the same voxel
+    VoxelGrid<int> lpc(nx, ny, nz);
+    vector<int> chunkMax(chunks, 0);
+    pool.parallelFor(chunks, [&](int c)
+    {
+        for (int k = c*nz/chunks; k < (c+1)*nz/chunks; k++)
+            for (int j=0; j<ny; j++)
+                for (int i=0; i<nx; i++)
+                {
+                    double density = cube(i, j, k);
+                    if (!(density>0))
+                        continue;
 
-            }
-
-    int maxCount = 0;
+                    int count = 0;
+                    sphere.forEachInside(i, j, k, nx, ny, nz, [&](long n)
+                    {
+                        count += density>averageDensity.at(n);
+                    });
+                    lpc(i, j, k) = count;
+                    chunkMax[c] = max(chunkMax[c], count);
+                }
+    });
 
-    for (long k=0; k<numSlcs(); k++)
-        for (long j=0; j<numCols(); j++)
-            for (long i=0; i<numRows(); i++)
-            {
-                if (lpc[i][j][k] > maxCount)
-                    maxCount = lpc[i][j][k];
-            }
+    int maxCount = *max_element(chunkMax.begin(), chunkMax.end());
 
-    for (long k=0; k<numSlcs(); k++)
-        for (long j=0; j<numCols(); j++)
-            for (long i=0; i<numRows(); i++)
-            {
-                if (lpc[i][j][k] < maxCount/divider)  // filter voxels have lower local-peak-count
-                    cube[i][j][k] = 0;
-            }
+    for (size_t n = 0; n < lpc.count(); n++)
+    {
+        if (lpc.at(n) < maxCount/divider)  // filter voxels have lower local-peak-count
+            cube.at(n) = 0;
+    }
 }
 ////////////////////////////////////////////////////////////////////////////////////////
 //delete small voxel group that has length smaller than minLength
@@ -1976,44 +1916,10 @@ void Map::deleteSmallVxlGroup(float minLength, float minSize)
 
     setApix();
 
-    node.resize(numRows());			    //resize rows
-	for(long i=0; i<numRows(); i++)
-	{
-		node[i].resize(numCols());		    //resize cols
-		for (long j=0; j<numCols(); j++)
-			node[i][j].resize(numSlcs());	//resize depth
-	}
-
-    // initialize the node structure
-    for (long k=0; k<numSlcs(); k++)
-        for (long j=0; j<numCols(); j++)
-            for (long i=0; i<numRows(); i++)
-            {
-                if (cube[i][j][k]>0)
-                {
-                    node[i][j][k].pos.x = i;
-                    node[i][j][k].pos.y = j;
-                    node[i][j][k].pos.z = k;
-                    node[i][j][k].density = cube[i][j][k];
-                }
-            }
-
     vector<vector<Node> > groups;
 
     //group the voxels
-    for (long k=1; k<numSlcs()-1; k++)
-        for (long j=1; j<numCols()-1; j++)
-            for (long i=1; i<numRows()-1; i++)
-            {
-                if (node[i][j][k].density>0 && node[i][j][k].traveled == false)
-                {
-                    vector<Node> temp; //temp group
-                    temp.push_back(node[i][j][k]);
-                    node[i][j][k].traveled = true;
-                    AddNearbyNodes(node[i][j][k],temp);
-                    groups.push_back(temp);  //push a group into the vector
-                }
-            }
+    clusterVoxels(groups);
 
     //cout<<"num of voxel groups before = "<<groups.size()<<endl;
 
@@ -2023,31 +1929,9 @@ void Map::deleteSmallVxlGroup(float minLength, float minSize)
         //cout<<groups.size()<<endl;
         if(groups[i].size() >= 2)
         {
-            double maxDistance = -999,
-                   length; // length of the voxel group
-
-            for (int j=0; j<groups[i].size()-1; j++)
-                for (int k=j+1; k<groups[i].size(); k++)
-                {
-                     if (maxDistance <= dist(groups[i][j], groups[i][k]))
-                         maxDistance = dist(groups[i][j], groups[i][k]);
-                }
-
-            bool flag = false;
-
-            for (int j=0; j<groups[i].size()-1; j++)
-            {
-                for (int k=j+1; k<groups[i].size(); k++)
-                     if (maxDistance == dist(groups[i][j], groups[i][k]))
-                     {
-                         length = maxDistance * apixX;
-
-                         flag = true;
-                         break;
-                     }
-                if (flag)
-                    break;
-            }
+            int first, second;
+            double maxDistance = farthestPair(groups[i], first, second),
+                   length = maxDistance * apixX; // length of the voxel group
 
             float totalSpace=0; //calculate the total Space for this group
             totalSpace = groups[i].size() * (apixX*apixX*apixX);
@@ -2076,32 +1960,139 @@ void Map::deleteSmallVxlGroup(float minLength, float minSize)
             cube[x][y][z] = 0;
         }
     }
-
-    //clear the node structure
-    node.clear();
-
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
-// add nearby voxel into group
-void Map::AddNearbyNodes(Node d, vector<Node> & group)
+// group the voxels above 0 that share a face. A group starts at a voxel inside the one voxel border, in
+// scan order, and takes its voxels in the order a depth first search from there meets them, one
+// neighbour at a time with an explicit stack, so groups of any size fit.
+void Map::clusterVoxels(vector<vector<Node> > & groups)
 {
-    int i = d.pos.x, j = d.pos.y, k = d.pos.z;
+    // the 6 face neighbours, in the order they are tried
+    const int steps[6][3] = {{-1,0,0}, {0,-1,0}, {0,0,-1}, {0,0,1}, {0,1,0}, {1,0,0}};
 
-    for (int n=-1; n<=1; n++)
-        for (int p=-1; p<=1; p++)
-            for (int q=-1; q<=1; q++)
-            {
-                int c=abs(n)+abs(p)+abs(q); // if c=1, consider 6 immediate neighbors; if c!=3, consider 18 neighbors
+    vector<bool> traveled(cube.count(), false);
+    vector<pair<size_t, int> > path;    // voxels of the search, each with the next neighbour of it to try
 
-                if (c==1 && node[i+n][j+p][k+q].density>0 && node[i+n][j+p][k+q].traveled == false)
+    for (long k=1; k<numSlcs()-1; k++)
+        for (long j=1; j<numCols()-1; j++)
+            for (long i=1; i<numRows()-1; i++)
+            {
+                size_t start = cube.index(i, j, k);
+                if (!(cube.data()[start]>0) || traveled[start])
+                    continue;
+
+                groups.push_back(vector<Node>());
+                vector<Node> & group = groups.back();
+
+                Node d;
+                d.pos.x = i;
+                d.pos.y = j;
+                d.pos.z = k;
+                d.density = cube.data()[start];
+                group.push_back(d);
+                traveled[start] = true;
+                path.push_back(make_pair(start, 0));
+
+                while (!path.empty())
                 {
-                    group.push_back(node[i+n][j+p][k+q]);
-                    node[i+n][j+p][k+q].traveled = true;
-                    AddNearbyNodes(node[i+n][j+p][k+q], group);
+                    size_t v = path.back().first;
+                    int s = path.back().second++;
+                    if (s == 6)
+                    {
+                        path.pop_back();
+                        continue;
+                    }
+
+                    int x, y, z;
+                    cube.position(v, x, y, z);
+                    x += steps[s][0];
+                    y += steps[s][1];
+                    z += steps[s][2];
+                    if (!cube.inside(x, y, z))
+                        continue;
+                    size_t n = cube.index(x, y, z);
+                    if (cube.data()[n]>0 && !traveled[n])
+                    {
+                        d.pos.x = x;
+                        d.pos.y = y;
+                        d.pos.z = z;
+                        d.density = cube.data()[n];
+                        group.push_back(d);
+                        traveled[n] = true;
+                        path.push_back(make_pair(n, 0));
+                    }
                 }
             }
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
+// the two nodes of a group furthest apart, first < second and the first such pair in the order of the group.
+// Returns their distance in voxels, as dist() gives it.
+float Map::farthestPair(const vector<Node> & group, int & first, int & second)
+{
+    first = second = 0;
+    if (group.size() < 2)
+        return 0;
+
+    auto distSq = [](const Node & p, const Node & q) -> long
+    {
+        long dx = p.pos.x - q.pos.x, dy = p.pos.y - q.pos.y, dz = p.pos.z - q.pos.z;
+        return dx*dx + dy*dy + dz*dz;
+    };
+    auto farthestFrom = [&](int from) -> int
+    {
+        int furthest = from;
+        for (int n=0; n<group.size(); n++)
+            if (distSq(group[n], group[from]) > distSq(group[furthest], group[from]))
+                furthest = n;
+        return furthest;
+    };
+
+    // two sweeps give a pair at least half as long as the longest, usually the longest itself
+    int a = farthestFrom(0);
+    int b = farthestFrom(a);
+    double lower = sqrt((double)distSq(group[a], group[b]));
+
+    // every voxel lies within radius of the centre of the box around the group, so a voxel p can only be
+    // in a pair as long as the bound when |p - centre| + radius reaches it
+    double low[3] = {1e30, 1e30, 1e30}, high[3] = {-1e30, -1e30, -1e30};
+    for (int n=0; n<group.size(); n++)
+    {
+        const Position & p = group[n].pos;
+        low[0] = min(low[0], (double)p.x); high[0] = max(high[0], (double)p.x);
+        low[1] = min(low[1], (double)p.y); high[1] = max(high[1], (double)p.y);
+        low[2] = min(low[2], (double)p.z); high[2] = max(high[2], (double)p.z);
+    }
+    vector<double> fromCentre(group.size());
+    double radius = 0;
+    for (int n=0; n<group.size(); n++)
+    {
+        const Position & p = group[n].pos;
+        double dx = p.x - (low[0]+high[0])/2, dy = p.y - (low[1]+high[1])/2, dz = p.z - (low[2]+high[2])/2;
+        fromCentre[n] = sqrt(dx*dx + dy*dy + dz*dz);
+        radius = max(radius, fromCentre[n]);
+    }
+    vector<int> candidates;
+    for (int n=0; n<group.size(); n++)
+        if (fromCentre[n] + radius >= lower - 1e-6)
+            candidates.push_back(n);
+
+    // exact search over the candidates, in group order so the first longest pair wins
+    long best = -1;
+    for (int p=0; p<candidates.size(); p++)
+        for (int q=p+1; q<candidates.size(); q++)
+        {
+            long d = distSq(group[candidates[p]], group[candidates[q]]);
+            if (d > best)
+            {
+                best = d;
+                first = candidates[p];
+                second = candidates[q];
+            }
+        }
+
+    return sqrt((double)best);
+}
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
 // calculate the distance btw to nodes based on voxel
 float Map::dist(Node p1, Node p2)
 {
@@ -2119,44 +2110,10 @@ void Map::Output_HLX(string pdbID, vector<Coordinate> curve_pnts)
     /////////////// cluster HLX points ///////////////////////
     cout<<"Clustering helix points..."<<endl<<endl;
 
-    node.resize(numRows());			    //resize rows
-	for(long i=0; i<numRows(); i++)
-	{
-		node[i].resize(numCols());		    //resize cols
-		for (long j=0; j<numCols(); j++)
-			node[i][j].resize(numSlcs());	//resize depth
-	}
-
-    // initialize the node structure
-    for (long k=0; k<numSlcs(); k++)
-        for (long j=0; j<numCols(); j++)
-            for (long i=0; i<numRows(); i++)
-            {
-                if (cube[i][j][k]>0)
-                {
-                    node[i][j][k].pos.x = i;
-                    node[i][j][k].pos.y = j;
-                    node[i][j][k].pos.z = k;
-                    node[i][j][k].density = cube[i][j][k];
-                }
-            }
-
     vector<vector<Node> > HLXclusters;
 
     //cluster the helix voxels
-    for (long k=1; k<numSlcs()-1; k++)
-        for (long j=1; j<numCols()-1; j++)
-            for (long i=1; i<numRows()-1; i++)
-            {
-                if (node[i][j][k].density>0 && node[i][j][k].traveled == false)
-                {
-                    vector<Node> temp; //temp group
-                    temp.push_back(node[i][j][k]);
-                    node[i][j][k].traveled = true;
-                    AddNearbyNodes(node[i][j][k],temp);
-                    HLXclusters.push_back(temp);  //push a group into the vector
-                }
-            }
+    clusterVoxels(HLXclusters);
 
     int NumofHLX = HLXclusters.size();
 
@@ -2164,36 +2121,13 @@ void Map::Output_HLX(string pdbID, vector<Coordinate> curve_pnts)
     cout<<"Find out two ends of each helix..."<<endl<<endl;
 
     for (int i=0; i<NumofHLX; i++)
-    {
-        double maxDistance = -999,
-               length; // length of this hilex
-
-        for (int j=0; j<HLXclusters[i].size()-1; j++)
-            for (int k=j+1; k<HLXclusters[i].size(); k++)
-            {
-                if (maxDistance <= dist(HLXclusters[i][j], HLXclusters[i][k]))
-                    maxDistance = dist(HLXclusters[i][j], HLXclusters[i][k]);
-            }
-
-        bool flag = false;
-
-        for (int j=0; j<HLXclusters[i].size()-1; j++)
+        if (HLXclusters[i].size() >= 2)
         {
-            for (int k=j+1; k<HLXclusters[i].size(); k++)
-                if (maxDistance == dist(HLXclusters[i][j], HLXclusters[i][k]))
-                {
-                    HLXclusters[i][j].isHlxEnd = true;
-                    HLXclusters[i][k].isHlxEnd = true;
-
-                    length = maxDistance * apixX;
-
-                    flag = true;
-                    break;
-                }
-            if (flag)
-                break;
+            int first, second;
+            farthestPair(HLXclusters[i], first, second);
+            HLXclusters[i][first].isHlxEnd = true;
+            HLXclusters[i][second].isHlxEnd = true;
         }
-    }
 
     cout<<"--- Number of detected helices = "<<NumofHLX<<endl<<endl;
 
@@ -2394,10 +2328,6 @@ void Map::Output_HLX(string pdbID, vector<Coordinate> curve_pnts)
     outfile<<endl<<"--- Number of detected helices = "<<NumofHLX<<endl;
     outfile.close();
     */
-
-
-    //clear the node structure
-    node.clear();
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 // find closest point to the End node in the HLX cluster
@@ -2433,44 +2363,10 @@ void Map::Output_SHT(string pdbID, vector<Coordinate> & curve_pnts)
 
     /////////////// cluster SHT points ///////////////////////
 
-    node.resize(numRows());			    //resize rows
-	for(long i=0; i<numRows(); i++)
-	{
-		node[i].resize(numCols());		    //resize cols
-		for (long j=0; j<numCols(); j++)
-			node[i][j].resize(numSlcs());	//resize depth
-	}
-
-    // initialize the node structure
-    for (long k=0; k<numSlcs(); k++)
-        for (long j=0; j<numCols(); j++)
-            for (long i=0; i<numRows(); i++)
-            {
-                if (cube[i][j][k]>0)
-                {
-                    node[i][j][k].pos.x = i;
-                    node[i][j][k].pos.y = j;
-                    node[i][j][k].pos.z = k;
-                    node[i][j][k].density = cube[i][j][k];
-                }
-            }
-
     vector<vector<Node> > SHTclusters;
 
     //cluster the sheet voxels
-    for (long k=1; k<numSlcs()-1; k++)
-        for (long j=1; j<numCols()-1; j++)
-            for (long i=1; i<numRows()-1; i++)
-            {
-                if (node[i][j][k].density>0 && node[i][j][k].traveled == false)
-                {
-                    vector<Node> temp; //temp group
-                    temp.push_back(node[i][j][k]);
-                    node[i][j][k].traveled = true;
-                    AddNearbyNodes(node[i][j][k],temp);
-                    SHTclusters.push_back(temp);  //push a group into the vector
-                }
-            }
+    clusterVoxels(SHTclusters);
 
     int NumofSHT = SHTclusters.size();
     cout<<"--- Number of detected sheets = "<<NumofSHT<<endl<<endl;
@@ -2529,9 +2425,6 @@ void Map::Output_SHT(string pdbID, vector<Coordinate> & curve_pnts)
 	    outgo_atoms.writePDB(outDirName + pdbID + "_sheet_" + indx + "_outgos.pdb", 1, outgo_atoms.numOfAA());
     }
 */
-
-    //clear the node structure
-    node.clear();
 }
 
 
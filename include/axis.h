@@ -1,6 +1,11 @@
 #ifndef AXIS_H_INCLUDED
 #define AXIS_H_INCLUDED
 
+#include <algorithm>
+#include "kdtree.h"
+#include "spline.h"
+#include "log.h"
+
 struct Displacement
 {
     double lengthAxis1;
@@ -14,17 +19,24 @@ struct Displacement
     double lengthProportion;
 };
 
+class AxisView;
+
 class Axis{
 public:
-    inline void addPoint(Coordinate c){axisPoints.push_back(c);}
+    inline void addPoint(Coordinate c){axisPoints.push_back(c); clearCaches();}
     void reverseOrder();
-    void alignDirectionHels(Axis* qptr);
-    Displacement findDisplacement(Axis* qptr, double stepSize);
-    Displacement findCrossDisplacement(Axis* qptr, double stepSize);
+    AxisView alignDirectionHels(Axis* qptr);     // q read in the direction of this axis; q itself is left alone
+    Displacement findDisplacement(AxisView q, double stepSize);
+    Displacement findCrossDisplacement(AxisView q, double stepSize);
     double getArcLength(vector<Coordinate>::iterator p1, vector<Coordinate>::iterator p2);
+    double getArcLength(int p1, int p2);    // signed arc length from index p1 to index p2, O(1) once the cache is built
+    void buildArcLengths();                 // call after editing axisPoints directly
+    int closestArcIndex(int qc, double arc, double &difference);
+    int closestPoint(const Coordinate &c, double &distance);   // index of the nearest axis point, -1 when empty
+    void buildCaches();     // build the lazy caches now, e.g. before the axis is read from several threads
     void catmullRom(double stepSize);
     void addTrueEnds(Coordinate pdbEnd1, Coordinate pdbEnd2);
-    double twoWayDistance(Axis* qptr);
+    double twoWayDistance(AxisView q);
 
     bool angle();
     void splitFirst();
@@ -41,8 +53,38 @@ public:
 // should be private but I'm not being that good.
     vector<Coordinate> axisPoints;
 
+private:
+    friend class AxisView;
+    double matchArcs(AxisView q, double stepSize, Axis &s, double &a, double &b);
+    inline void clearCaches(){arcLengths.clear(); pointTree.clear();}
+
+    vector<double> arcLengths;  // arcLengths[i] is the arc length from axisPoints[0] to axisPoints[i]
+    KDTree pointTree;           // built on the first closestPoint() query
+
+
+};
+
+// An axis read front to back, or back to front when reversed, without copying or reordering its
+// points. Index i of a reversed view is point size()-1-i of the axis, and arc lengths and closest
+// point ties follow the view's order. Views only read the axis, apart from building its lazy caches,
+// so any number of them can share one axis once buildCaches() has been called.
+class AxisView{
+public:
+    AxisView(Axis* axis, bool reversed = false) : axis(axis), reversed(reversed) {}
+
+    inline int size() const {return axis->axisPoints.size();}
+    inline const Coordinate& point(int i) const {return axis->axisPoints[reversed ? size()-1-i : i];}
+    inline bool isReversed() const {return reversed;}
 
+    double getArcLength(int p1, int p2);
+    int closestArcIndex(int qc, double arc, double &difference);
+    int closestPoint(const Coordinate &c, double &distance);
 
+private:
+    inline int toAxis(int i) const {return reversed ? size()-1-i : i;}
+
+    Axis* axis;
+    bool reversed;
 };
 
 void Axis::addTrueEnds(Coordinate pdbEnd1, Coordinate pdbEnd2) // where End1 is the "far" end of the helix, at the end of axisPoints
@@ -120,6 +162,7 @@ void Axis::addTrueEnds(Coordinate pdbEnd1, Coordinate pdbEnd2) // where End1 is
     }
     axisPoints.insert(axisPoints.begin(), bestEnd);
       // cerr << "Final choice is " << axisPoints[0].x << " " << axisPoints[0].y << " " << axisPoints[0].z << endl;
+    clearCaches();
     return;
 }
 
@@ -133,6 +176,7 @@ void Axis::reverseOrder()
     for(int i = 0; i < tempAxisPoints.size(); i++)
         axisPoints.push_back(tempAxisPoints[i]);
 
+    clearCaches();
     return;
 }
 
@@ -221,6 +265,7 @@ void Axis::splitFirst()
             */
             i = axisPoints.size();
             axisPoints = tempPoints;
+            clearCaches();
         }
     }
 }
@@ -278,6 +323,7 @@ void Axis::splitSecond()
             */
             i = 0;
             axisPoints = tempPoints;
+            clearCaches();
         }
     }
 }
@@ -291,6 +337,7 @@ void Axis::splitFirstHalf()
         tempPoints.push_back(axisPoints[i]);
     }
     axisPoints = tempPoints;
+    clearCaches();
 }
 
 void Axis::splitSecondHalf()
@@ -302,6 +349,7 @@ void Axis::splitSecondHalf()
         tempPoints.push_back(axisPoints[i]);
     }
     axisPoints = tempPoints;
+    clearCaches();
 }
 
 Coordinate Axis::firstPoint()
@@ -356,119 +404,125 @@ void Axis::printAsPnts2 (string outputFileName)
 
 void Axis::catmullRom(double stepSize)
 {
-    struct Coordinate p0;
-    struct Coordinate p1;
-    struct Coordinate p2;
-    struct Coordinate p3;
+    if (axisPoints.empty())
+        return;
+
+    // the end points act as their own outer neighbours; index into the control points with clamping
+    // rather than inserting copies at both ends
+    vector<Coordinate> ctrl;
+    ctrl.swap(axisPoints);
+    int last = ctrl.size()-1;
     double approxDistance = 0;
     int numInterpPoints = 0;
-    vector<Coordinate> tempAxis;
-    Coordinate v;
-    //cout << axisPoints[0].x << " " << axisPoints[0].y << " " << axisPoints[0].z << endl;
-    tempAxis.push_back(axisPoints[0]);
-    axisPoints.insert(axisPoints.begin(), *(axisPoints.begin()));
-    axisPoints.push_back(axisPoints[axisPoints.size()-1]);
-    for (int j = 1; j < axisPoints.size()-2; j++)
+
+    int estimate = 1;
+    for (int j = 0; j < last; j++)
+        estimate += max(1, (int)(getDistance(ctrl[j], ctrl[j+1])/stepSize) + 1);
+    axisPoints.clear();
+    axisPoints.reserve(estimate);
+
+    for (int j = 0; j < last; j++)
         {
-            approxDistance = getDistance(axisPoints[j], axisPoints[j+1]);
+            approxDistance = getDistance(ctrl[j], ctrl[j+1]);
             //cerr << "Approximate distance: " << approxDistance << endl;
             numInterpPoints = approxDistance/stepSize;
             //cerr << "Number of interpolated points: " << numInterpPoints << endl;
-            p0 = axisPoints[j-1];
-            p1 = axisPoints[j];
-            p2 = axisPoints[j+1];
-            p3 = axisPoints[j+2];
+            const Coordinate &p0 = ctrl[max(j-1, 0)];
+            const Coordinate &p1 = ctrl[j];
+            const Coordinate &p2 = ctrl[j+1];
+            const Coordinate &p3 = ctrl[min(j+2, last)];
             for (double t = 0.0; t < 1.00; t = t + 1.0/numInterpPoints)
-            {
-                double t2 = t*t;
-                double t3 = t*t*t;
-                v.x = 0.5 *((2 * p1.x) + (-p0.x + p2.x) * t + (2*p0.x - 5*p1.x + 4*p2.x - p3.x) * t2 + (-p0.x + 3*p1.x- 3*p2.x + p3.x) * t3);
-                v.y = 0.5 *((2 * p1.y) + (-p0.y + p2.y) * t + (2*p0.y - 5*p1.y + 4*p2.y - p3.y) * t2 + (-p0.y + 3*p1.y- 3*p2.y + p3.y) * t3);
-                v.z = 0.5 *((2 * p1.z) + (-p0.z + p2.z) * t + (2*p0.z - 5*p1.z + 4*p2.z - p3.z) * t2 + (-p0.z + 3*p1.z- 3*p2.z + p3.z) * t3);
-                tempAxis.push_back(v);
-            }
+                axisPoints.push_back(catmullRomPoint(p0, p1, p2, p3, t));
         }
-    axisPoints.clear();
 
-    for (int i = 1; i < tempAxis.size(); i++) ///
-        axisPoints.push_back(tempAxis[i]);
-
-    if (tempAxis.size() == 1 && axisPoints.size() == 0)
-        axisPoints.push_back(tempAxis[0]);
+    if (axisPoints.empty())
+        axisPoints.push_back(ctrl[0]);
 
+    arcLengths.clear();
+    pointTree.clear();
+    buildArcLengths();
     return;
 }
 
-void Axis::alignDirectionHels(Axis* qptr)
+AxisView Axis::alignDirectionHels(Axis* qptr)
 {
-    vector<Coordinate> tempAxis;
     Vectors p (axisPoints[0], axisPoints[axisPoints.size()-1]);
     Vectors q1 (qptr->axisPoints[0], qptr->axisPoints[qptr->axisPoints.size()-1]);
     Vectors q2 (qptr->axisPoints[qptr->axisPoints.size()-1], qptr->axisPoints[0]);
 
     if (p.dot(q1) < p.dot(q2))
-        {qptr->reverseOrder();
-        cerr << "Reversed this helix." << endl;
-        }
+    {
+        LOG_DEBUG(LOG_DISPLACEMENT, "Reversed this helix.");
+        return AxisView(qptr, true);
+    }
 
-    return;
+    return AxisView(qptr);
 }
 
-double Axis::getArcLength(vector<Coordinate>::iterator p1, vector<Coordinate>::iterator p2)
+void Axis::buildArcLengths()
 {
     double arcLength = 0;
-    bool flip = false;
-    vector<Coordinate>::iterator prevItr;
-    vector<Coordinate>::iterator nextItr;
-
-    int p1ind, p2ind, index;
-    index = 0;
-    p1ind = 0;
-    p2ind = 0;
-
-    for(prevItr = axisPoints.begin(); prevItr != axisPoints.end(); prevItr++)
+    arcLengths.resize(axisPoints.size());
+    for (int i = 0; i < axisPoints.size(); i++)
     {
-        index++;
-        if (prevItr == p1)
-            p1ind = index;
-        if (prevItr == p2)
-            p2ind = index;
+        if (i > 0)
+            arcLength += getDistance(axisPoints[i-1], axisPoints[i]);
+        arcLengths[i] = arcLength;
     }
+    return;
+}
 
+double Axis::getArcLength(int p1, int p2)
+{
+    if (axisPoints.empty())
+        return 0;
+    if (arcLengths.size() != axisPoints.size())
+        buildArcLengths();
 
-    for (nextItr = axisPoints.begin(); nextItr != p1; nextItr++) // if p1 comes after p2 in the list
-        if(nextItr == p2)
-        {
-            prevItr = p2;
-            p2 = p1;
-            p1 = prevItr;
-            flip = true;
-            break;
-        }
+    // an index past the end measures up to the last point, same as passing end() to the iterator version
+    p1 = max(0, min(p1, (int)axisPoints.size()-1));
+    p2 = max(0, min(p2, (int)axisPoints.size()-1));
 
-    nextItr = p1;
-    nextItr++;
-    index = 0;
-    for (prevItr = p1; (prevItr != p2) && (nextItr != axisPoints.end()); prevItr++)
-    {
-        index++;
-        //cerr << index << " steps currently calculated for arclength" << endl;
-        arcLength += getDistance(*prevItr, *nextItr);
-        nextItr++;
-    }
+    return arcLengths[p2] - arcLengths[p1];
+}
+
+double Axis::getArcLength(vector<Coordinate>::iterator p1, vector<Coordinate>::iterator p2)
+{
+    return getArcLength((int)(p1 - axisPoints.begin()), (int)(p2 - axisPoints.begin()));
+}
 
-    if (flip == true)
-        arcLength *= -1;
+// index on this axis whose arc length to qc is closest to arc; ties go to the lower index
+int Axis::closestArcIndex(int qc, double arc, double &difference)
+{
+    difference = 999999;
+    if (axisPoints.empty())
+        return 0;
+    if (arcLengths.size() != axisPoints.size())
+        buildArcLengths();
+
+    // getArcLength(qi, qc) = arcLengths[qc] - arcLengths[qi] is non-increasing in qi,
+    // so the best match sits next to where arcLengths crosses arcLengths[qc] - arc
+    int found = lower_bound(arcLengths.begin(), arcLengths.end(), arcLengths[qc] - arc) - arcLengths.begin();
+    int first = max(found - 2, 0);
+    int last = min(found + 1, (int)arcLengths.size()-1);
+    first = lower_bound(arcLengths.begin(), arcLengths.end(), arcLengths[first]) - arcLengths.begin();
+
+    int closest = first;
+    for (int qi = first; qi <= last; qi++)
+        if (abs(getArcLength(qi, qc) - arc) < difference)
+        {
+            difference = abs(getArcLength(qi, qc) - arc);
+            closest = qi;
+        }
 
-    return arcLength;
+    return closest;
 }
 
-Displacement Axis::findCrossDisplacement(Axis* qptr, double stepSize)
+// pairs points of p and q at equal arc length from their closest pair, collecting the matched
+// stretch of p in s; returns the sum of squared distances and the shared arc interval [a, b]
+double Axis::matchArcs(AxisView q, double stepSize, Axis &s, double &a, double &b)
 {
-    Displacement displaced;
-    double a, b;
-    vector<Coordinate>::iterator pc, qc, pi, qi, qiTemp;
-    Axis s;
+    int pc = 0, qc = 0, qi = 0;
     double distance = 0;
     double minDistance = 99999;
     double currentArc = 0;
@@ -476,214 +530,172 @@ Displacement Axis::findCrossDisplacement(Axis* qptr, double stepSize)
     double sum = 0;
     bool startS = false;
 
-    for (pi = axisPoints.begin(); pi != axisPoints.end(); pi++)
-        for (qi = qptr->axisPoints.begin(); qi != qptr->axisPoints.end(); qi++)
-        {
-            distance = getDistance(*pi, *qi);
-            if (distance < minDistance)
-            {
-                minDistance = distance;
-                pc = pi;
-                qc = qi;
-            }
-        }
-
-    int closeIndexP = 0;
-    int closeIndexQ = 0;
-    for(pi = axisPoints.begin(); pi != axisPoints.end(); pi++)
-        {
-            if (pi == pc)
-                break;
-            closeIndexP++;
-        }
-    for(qi = qptr->axisPoints.begin(); qi != qptr->axisPoints.end(); qi++)
+    for (int pi = 0; pi < axisPoints.size(); pi++)
+    {
+        int qj = q.closestPoint(axisPoints[pi], distance);
+        if (qj >= 0 && distance < minDistance)
         {
-            if (qi == qc)
-                break;
-            closeIndexQ++;
+            minDistance = distance;
+            pc = pi;
+            qc = qj;
         }
+    }
 
-    cerr << "Closest point on p is " << pc->x << " " << pc->y << " " << pc->z << " at index " << closeIndexP << endl;
-    cerr << "Closest point on q is " << qc->x << " " << qc->y << " " << qc->z << " at index " << closeIndexQ << endl;
-    cerr << endl;
+    LOG_DEBUG(LOG_DISPLACEMENT, "Closest point on p is " << axisPoints[pc].x << " " << axisPoints[pc].y << " " << axisPoints[pc].z << " at index " << pc);
+    LOG_DEBUG(LOG_DISPLACEMENT, "Closest point on q is " << q.point(qc).x << " " << q.point(qc).y << " " << q.point(qc).z << " at index " << qc);
 
-    double a1 = -abs(getArcLength(axisPoints.begin(), pc));
-    double a2 = -abs(qptr->getArcLength(qptr->axisPoints.begin(), qc));
-    double b1 = abs(getArcLength(axisPoints.begin(), axisPoints.end()-1)) - abs(getArcLength(axisPoints.begin(), pc));
-    double b2 = abs(qptr->getArcLength(qptr->axisPoints.begin(), qptr->axisPoints.end()-1)) - abs(qptr->getArcLength(qptr->axisPoints.begin(), qc));
+    double a1 = -abs(getArcLength(0, pc));
+    double a2 = -abs(q.getArcLength(0, qc));
+    double b1 = abs(getArcLength(0, axisPoints.size()-1)) - abs(getArcLength(0, pc));
+    double b2 = abs(q.getArcLength(0, q.size()-1)) - abs(q.getArcLength(0, qc));
 
     a = max(a1, a2);
     b = min(b1, b2);
-    cerr << "b = " << b << endl;
-    cerr << "a = " << a << endl;
-    int testIndexP = 0;
-    cerr << "Number of points in p is " << axisPoints.size() << endl;
-    cerr << "Number of points in q is " << qptr->axisPoints.size() << endl << endl;
-    for (pi = axisPoints.begin(); pi != axisPoints.end(); pi++)
+    LOG_DEBUG(LOG_DISPLACEMENT, "b = " << b << ", a = " << a);
+    LOG_DEBUG(LOG_DISPLACEMENT, "Number of points in p is " << axisPoints.size() << ", in q is " << q.size());
+    for (int pi = 0; pi < axisPoints.size(); pi++)
     {
-        closestArc = 999999;
         currentArc = getArcLength(pi, pc);
-        //cerr << "Matching an arc on p of length " << currentArc << " at index " << testIndexP << endl;
+        qi = q.closestArcIndex(qc, currentArc, closestArc);
 
-        int testIndexQ = 0;
-        for(qiTemp = qptr->axisPoints.begin(); qiTemp != qptr->axisPoints.end(); qiTemp++)
-        {
-            if (abs(qptr->getArcLength(qiTemp, qc) - currentArc) < closestArc)
-            {
-                closestArc = abs(qptr->getArcLength(qiTemp, qc) - currentArc);
-                qi = qiTemp;
-            }
-        }
-        //cerr << "Found the closest matching arc; the difference in arc lengths is " << closestArc << endl;
         if (closestArc < 2*stepSize) // iffy
             {
-                for(qiTemp = qptr->axisPoints.begin(); qiTemp != qptr->axisPoints.end(); qiTemp++)
-                {
-                    if (qiTemp == qi)
-                        break;
-                        testIndexQ++;
-                }
-                //cerr << "Matched with an arc on q of length " << qptr->getArcLength(qi, qc) << " at index " << testIndexQ << endl << endl;
                 startS = true;
-                sum +=pow(getDistance(*pi,*qi), 2);
-                s.axisPoints.push_back(*pi);
+                sum +=pow(getDistance(axisPoints[pi], q.point(qi)), 2);
+                s.axisPoints.push_back(axisPoints[pi]);
             }
-        //else if (startS == false)
-            //cerr << "p has started before q. Not starting line s yet." << endl << endl;
         else if (startS == true)
-            {cerr << "q has ended before p. Ending line s." << endl << endl; break;}
-
-        testIndexP++;
+            {LOG_TRACE(LOG_DISPLACEMENT, "q has ended before p. Ending line s."); break;}
     }
+
+    return sum;
+}
+
+Displacement Axis::findCrossDisplacement(AxisView q, double stepSize)
+{
+    Displacement displaced;
+    double a, b;
+    Axis s;
+    double sum = matchArcs(q, stepSize, s, a, b);
+
     if (b-a == 0)
-        cerr << "Insufficient length for cross-displacement comparison. Continuing..." << endl;
+        LOG_WARN(LOG_DISPLACEMENT, "Insufficient length for cross-displacement comparison. Continuing...");
     displaced.crossDisplace = sqrt(sum*stepSize/(b-a));
     return displaced;
 }
 
-Displacement Axis::findDisplacement(Axis* qptr, double stepSize)
+Displacement Axis::findDisplacement(AxisView q, double stepSize)
 {
-    cerr << "For true axis p and traced axis q: " << endl;
+    LOG_DEBUG(LOG_DISPLACEMENT, "For true axis p and traced axis q:");
     Displacement displaced;
     double a, b;
-    vector<Coordinate>::iterator pc, qc, pi, qi, qiTemp;
     Axis s;
-    double distance = 0;
-    double minDistance = 99999;
-    double currentArc = 0;
-    double closestArc = 99999;
-    double sum = 0;
-    bool startS = false;
-
-    for (pi = axisPoints.begin(); pi != axisPoints.end(); pi++)
-        for (qi = qptr->axisPoints.begin(); qi != qptr->axisPoints.end(); qi++)
-        {
-            distance = getDistance(*pi, *qi);
-            if (distance < minDistance)
-            {
-                minDistance = distance;
-                pc = pi;
-                qc = qi;
-            }
-        }
-
-    int closeIndexP = 0;
-    int closeIndexQ = 0;
-    for(pi = axisPoints.begin(); pi != axisPoints.end(); pi++)
-        {
-            if (pi == pc)
-                break;
-            closeIndexP++;
-        }
-    for(qi = qptr->axisPoints.begin(); qi != qptr->axisPoints.end(); qi++)
-        {
-            if (qi == qc)
-                break;
-            closeIndexQ++;
-        }
-
-    cerr << "Closest point on p is " << pc->x << " " << pc->y << " " << pc->z << " at index " << closeIndexP << endl;
-    cerr << "Closest point on q is " << qc->x << " " << qc->y << " " << qc->z << " at index " << closeIndexQ << endl;
-    cerr << endl;
-
-    double a1 = -abs(getArcLength(axisPoints.begin(), pc));
-    double a2 = -abs(qptr->getArcLength(qptr->axisPoints.begin(), qc));
-    double b1 = abs(getArcLength(axisPoints.begin(), axisPoints.end()-1)) - abs(getArcLength(axisPoints.begin(), pc));
-    double b2 = abs(qptr->getArcLength(qptr->axisPoints.begin(), qptr->axisPoints.end()-1)) - abs(qptr->getArcLength(qptr->axisPoints.begin(), qc));
-
-    a = max(a1, a2);
-    b = min(b1, b2);
-    cerr << "b = " << b << endl;
-    cerr << "a = " << a << endl;
-    int testIndexP = 0;
-    cerr << "Number of points in p is " << axisPoints.size() << endl;
-    cerr << "Number of points in q is " << qptr->axisPoints.size() << endl << endl;
-    for (pi = axisPoints.begin(); pi != axisPoints.end(); pi++)
-    {
-        closestArc = 999999;
-        currentArc = getArcLength(pi, pc);
-        //cerr << "Matching an arc on p of length " << currentArc << " at index " << testIndexP << endl;
-
-        int testIndexQ = 0;
-        for(qiTemp = qptr->axisPoints.begin(); qiTemp != qptr->axisPoints.end(); qiTemp++)
-        {
-            if (abs(qptr->getArcLength(qiTemp, qc) - currentArc) < closestArc)
-            {
-                closestArc = abs(qptr->getArcLength(qiTemp, qc) - currentArc);
-                qi = qiTemp;
-            }
-        }
-        //cerr << "Found the closest matching arc; the difference in arc lengths is " << closestArc << endl;
-        if (closestArc < 2*stepSize) // iffy
-            {
-                for(qiTemp = qptr->axisPoints.begin(); qiTemp != qptr->axisPoints.end(); qiTemp++)
-                {
-                    if (qiTemp == qi)
-                        break;
-                        testIndexQ++;
-                }
-                //cerr << "Matched with an arc on q of length " << qptr->getArcLength(qi, qc) << " at index " << testIndexQ << endl << endl;
-                startS = true;
-                sum +=pow(getDistance(*pi,*qi), 2);
-                s.axisPoints.push_back(*pi);
-            }
-        //else if (startS == false)
-            //cerr << "p has started before q. Not starting line s yet." << endl << endl;
-        else if (startS == true)
-            {cerr << "q has ended before p. Ending line s." << endl << endl; break;}
+    double sum = matchArcs(q, stepSize, s, a, b);
 
-        testIndexP++;
-    }
     if (b-a == 0)
-        cerr << "Insufficient length for cross-displacement comparison. Continuing..." << endl;
+        LOG_WARN(LOG_DISPLACEMENT, "Insufficient length for cross-displacement comparison. Continuing...");
     displaced.crossDisplace = sqrt(sum*stepSize/(b-a));
 
 
     displaced.lengthAxis1 = getArcLength(axisPoints.begin(), axisPoints.end()-1);
-    displaced.lengthAxis2 = qptr->getArcLength(qptr->axisPoints.begin(), qptr->axisPoints.end()-1);
-    displaced.twoWayDistance = s.twoWayDistance(qptr);
+    displaced.lengthAxis2 = q.getArcLength(0, q.size()-1);
+    displaced.twoWayDistance = s.twoWayDistance(q);
     displaced.lengthComparison = s.getArcLength(s.axisPoints.begin(), s.axisPoints.end()-1);
     displaced.longDisplace = displaced.lengthAxis1 + displaced.lengthAxis2 - 2*displaced.lengthComparison;
         if(displaced.longDisplace < 0)
         {
-            cerr << "Lines match through near the entirety of their lengths." << endl;
+            LOG_DEBUG(LOG_DISPLACEMENT, "Lines match through near the entirety of their lengths.");
             displaced.lengthComparison = min(displaced.lengthAxis1, displaced.lengthAxis2);
             displaced.longDisplace = displaced.lengthAxis1 + displaced.lengthAxis2 - 2*displaced.lengthComparison;
         }
-    cerr << "Length of p is " << displaced.lengthAxis1 << endl;
-    cerr << "Length of q is " << displaced.lengthAxis2 << endl;
-    cerr << "Length of s is " << displaced.lengthComparison << endl;
-
-    cerr << "Cross displacement is " << displaced.crossDisplace << endl;
-    cerr << "Longitudinal displacement is " << displaced.longDisplace << endl;
+    LOG_DEBUG(LOG_DISPLACEMENT, "Length of p is " << displaced.lengthAxis1 << ", q is " << displaced.lengthAxis2 << ", s is " << displaced.lengthComparison);
+    LOG_DEBUG(LOG_DISPLACEMENT, "Cross displacement is " << displaced.crossDisplace << ", longitudinal displacement is " << displaced.longDisplace);
 
     displaced.lengthProportion = displaced.longDisplace/(displaced.longDisplace+b-a);
-    cerr << "Proportion of incorrect length to combined length of axes is " << displaced.lengthProportion << endl;
+    LOG_DEBUG(LOG_DISPLACEMENT, "Proportion of incorrect length to combined length of axes is " << displaced.lengthProportion);
 
     return displaced;
 }
 
-double Axis::twoWayDistance(Axis* qptr)
+int Axis::closestPoint(const Coordinate &c, double &distance)
+{
+    if (pointTree.size() != axisPoints.size())
+        pointTree.build(axisPoints);
+
+    int closest = pointTree.nearest(c, distance);
+    if (closest >= 0)
+        distance = getDistance(c, axisPoints[closest]);
+    return closest;
+}
+
+void Axis::buildCaches()
+{
+    if (arcLengths.size() != axisPoints.size())
+        buildArcLengths();
+    if (pointTree.size() != axisPoints.size())
+        pointTree.build(axisPoints);
+    return;
+}
+
+double AxisView::getArcLength(int p1, int p2)
+{
+    if (!reversed)
+        return axis->getArcLength(p1, p2);
+    return axis->getArcLength(toAxis(p2), toAxis(p1));
+}
+
+int AxisView::closestArcIndex(int qc, double arc, double &difference)
+{
+    if (!reversed)
+        return axis->closestArcIndex(qc, arc, difference);
+
+    difference = 999999;
+    if (size() == 0)
+        return 0;
+    vector<double> &arcLengths = axis->arcLengths;
+    if (arcLengths.size() != size())
+        axis->buildArcLengths();
+
+    // getArcLength(qi, qc) = arcLengths[toAxis(qi)] - arcLengths[toAxis(qc)], so look for the axis
+    // index whose prefix sum is closest to arcLengths[toAxis(qc)] + arc. Of equal prefix sums the
+    // highest axis index is the lowest view index, which is the one the forward search would keep.
+    double target = arcLengths[toAxis(qc)] + arc;
+    int found = lower_bound(arcLengths.begin(), arcLengths.end(), target) - arcLengths.begin();
+    int closest = -1;
+    if (found > 0)
+    {
+        closest = found-1;
+        difference = abs(arcLengths[closest] - target);
+    }
+    if (found < size())
+    {
+        int last = upper_bound(arcLengths.begin(), arcLengths.end(), arcLengths[found]) - arcLengths.begin() - 1;
+        if (closest < 0 || abs(arcLengths[last] - target) <= difference)
+        {
+            closest = last;
+            difference = abs(arcLengths[last] - target);
+        }
+    }
+
+    return toAxis(closest);
+}
+
+int AxisView::closestPoint(const Coordinate &c, double &distance)
+{
+    if (!reversed)
+        return axis->closestPoint(c, distance);
+
+    if (axis->pointTree.size() != size())
+        axis->pointTree.build(axis->axisPoints);
+
+    int closest = axis->pointTree.nearest(c, distance, true);
+    if (closest < 0)
+        return closest;
+    distance = getDistance(c, axis->axisPoints[closest]);
+    return toAxis(closest);
+}
+
+double Axis::twoWayDistance(AxisView q)
 {
     double average1 = 0;
     double average2 = 0;
@@ -692,25 +704,19 @@ double Axis::twoWayDistance(Axis* qptr)
 
     for (int i = 0; i < axisPoints.size(); i++)
     {
-        for (int j = 0; j < qptr->axisPoints.size(); j++)
-        {
-            if (getDistance(axisPoints[i], qptr->axisPoints[j]) < closestDistance)
-                closestDistance = getDistance(axisPoints[i], qptr->axisPoints[j]);
-        }
+        if (q.closestPoint(axisPoints[i], closestDistance) < 0)
+            closestDistance = 99999;
         average1 += closestDistance;
-        closestDistance = 99999;
     }
     average1 /= axisPoints.size();
 
-    for (int j = 0; j < qptr->axisPoints.size(); j++)
+    for (int j = 0; j < q.size(); j++)
     {
-        for(int i = 0; i < axisPoints.size(); i++)
-            if(getDistance(axisPoints[i], qptr->axisPoints[j]) < closestDistance)
-                closestDistance = getDistance(axisPoints[i], qptr->axisPoints[j]);
+        if (closestPoint(q.point(j), closestDistance) < 0)
+            closestDistance = 99999;
         average2 += closestDistance;
-        closestDistance = 99999;
     }
-    average2 /= qptr->axisPoints.size();
+    average2 /= q.size();
 
     distance = (average1 + average2)/2;
 
@@ -724,29 +730,19 @@ int PrintSpecificity(vector<Axis>* traces, vector<int>* specArray, Protein pdb,
 {
     int hlxAA=0, fpHLXAA=0;  // # of total, fp-false positive
     int totalAA = pdb.numOfAA();
-    bool matched = false;
 
     for (int n=0; n<pdb.numOfAA(); n++)
     {
         pdb.setBBCenter(n);  // BB center of this true sheet AA
         for (int m=0; m<helixOffset; m++)
         {
-            matched = false;
             if(n < pdb.hlces[m].startIndx || n > pdb.hlces[m].endIndx)
             {
-                for(int i = 0; i < traces->at(m).axisPoints.size(); i++)
+                double distance = 0;
+                if (traces->at(m).closestPoint(pdb.AAs[n].coord, distance) >= 0 && distance <= 2.5) // was 3
                 {
-                    Coordinate p = traces->at(m).axisPoints[i];
-                    if (getDistance(p, pdb.AAs[n].coord) <= 2.5) // was 3
-                    {
-                        if(matched == false)
-                        {
-                            fpHLXAA++;  // count for helix false positive
-                            specArray->at(m)++;
-                        }
-                        matched = true;
-                        break;
-                    }
+                    fpHLXAA++;  // count for helix false positive
+                    specArray->at(m)++;
                 }
             }
             else
@@ -761,29 +757,19 @@ int PrintSpecificityStrands(vector<Axis>* traces, vector<int>* specArray, Protei
 {
     int StrandAA=0, fpStrandAA=0;  // # of total, fp-false positive
     int totalAA = pdb.numOfAA();
-    bool matched = false;
 
     for (int n=0; n<pdb.numOfAA(); n++)
     {
         pdb.setBBCenter(n);  // BB center of this true helix AA
         for (int m=helixOffset; m<traces->size(); m++)
         {
-            matched = false;
             if(n < pdb.sheets[m].startIndx || n > pdb.sheets[m].endIndx)
             {
-                for(int i = 0; i < traces->at(m).axisPoints.size(); i++)
+                double distance = 0;
+                if (traces->at(m).closestPoint(pdb.AAs[n].coord, distance) >= 0 && distance <= 2.5) // was 3
                 {
-                    Coordinate p = traces->at(m).axisPoints[i];
-                    if (getDistance(p, pdb.AAs[n].coord) <= 2.5) // was 3
-                    {
-                        if(matched == false)
-                        {
-                            fpStrandAA++;  // count for helix false positive
-                            specArray->at(m)++;
-                        }
-                        matched = true;
-                        break;
-                    }
+                    fpStrandAA++;  // count for helix false positive
+                    specArray->at(m)++;
                 }
             }
             else
@@ -819,15 +805,11 @@ double PrintSensitivity(Axis* trace, int startIndx, int endIndx, Protein pdb, do
             hlxAA++;
             pdb.setBBCenter(n);  // BB center of this true helix AA
 
-            for (double i = 0; i < trace->axisPoints.size(); i++)
+            double distance = 0;
+            if (trace->closestPoint(pdb.AAs[n].coord, distance) >= 0 && distance <= radius)
             {
-                    Coordinate p = trace->axisPoints[i];
-                    if (getDistance(p, pdb.AAs[n].coord) <= radius)
-                    {
-                        tpHLXAA++; // count for helix true positive
-                        matched = true;
-                        break;
-                    }
+                tpHLXAA++; // count for helix true positive
+                matched = true;
             }
         }
     }
@@ -852,15 +834,11 @@ double PrintSensitivityStrands(Axis* trace, int startIndx, int endIndx, Protein
             hlxAA++;
             pdb.setBBCenter(n);  // BB center of this true helix AA
 
-            for (double i = 0; i < trace->axisPoints.size(); i++)
+            double distance = 0;
+            if (trace->closestPoint(pdb.AAs[n].coord, distance) >= 0 && distance <= radius)
             {
-                    Coordinate p = trace->axisPoints[i];
-                    if (getDistance(p, pdb.AAs[n].coord) <= radius)
-                    {
-                        tpHLXAA++; // count for helix true positive
-                        matched = true;
-                        break;
-                    }
+                tpHLXAA++; // count for helix true positive
+                matched = true;
             }
         }
     }
@@ -915,17 +893,11 @@ int specificityBoundaries(Protein pdb, Axis* trueHels, bool helix, int current)
     //string s = "C:\\Users\\dhaslam\\Desktop\\1CHD\\test" + id_str +".pdb";
     //temp.printAsPnts(s.c_str());
 
+    double distance = 0;
     for(int i = 0; i < pdb.numOfAA(); i++)
     {
-        for(int j = 0; j < temp.axisPoints.size(); j++)
-        {
-            Coordinate p = temp.axisPoints[j];
-            if (getDistance(p, pdb.AAs[i].coord) <= 10)
-            {
-                numInBox++;
-                break;
-            }
-        }
+        if (temp.closestPoint(pdb.AAs[i].coord, distance) >= 0 && distance <= 10)
+            numInBox++;
     }
 
     return numInBox;
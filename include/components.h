@@ -0,0 +1,344 @@
+#ifndef COMPONENTS_H_INCLUDED
+#define COMPONENTS_H_INCLUDED
+
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <stdlib.h>
+#include "voxelgrid.h"
+
+// Which voxels touch: the 6 that share a face, the 18 that share a face or an edge, or all 26 around
+enum Connectivity
+{
+    CONNECT_6 = 6,
+    CONNECT_18 = 18,
+    CONNECT_26 = 26
+};
+
+// Groups of touching voxels above a threshold, labelled with union-find in a single pass over the
+// slices in z order and resolved in finish(). Each voxel only looks at the neighbours met before it,
+// in its own slice and the one below, so besides the voxels found only the labels of two slices are
+// held; the slices can come from a whole grid or from a stream. Linear in the number of voxels, with
+// no limit on the number or the size of the groups.
+class VoxelComponents{
+public:
+    explicit VoxelComponents(double threshold, Connectivity connect = CONNECT_26);
+
+    void addSlice(const float* slice, int nx, int ny, int k);  //slice k of an nx * ny * nz map, slices must come in z order
+    void add(const VoxelGrid<float> &grid);                     //every slice of a grid
+    int finish(int minSize = 1);        //groups of fewer than minSize voxels are dropped; returns the number of groups
+
+    // Instead of finish(), while the slices come: hands every group with no voxel in the last slice
+    // added, which can grow no more, to emit with its voxels in scan order, and forgets it; with all,
+    // every group goes. Groups of fewer than minSize voxels are dropped. Only the voxels of the groups
+    // still open are kept, and those groups are numbered anew.
+    void flush(function<void(const vector<size_t>&)> emit, int minSize = 1, bool all = false);
+
+    // group of every voxel of a map of count voxels, -1 for the voxels in no group
+    void labelMap(vector<int> &label, size_t count) const;
+
+    // after finish(): every voxel of a group in scan order, as its index in the map (i + nx*(j + ny*k)),
+    // with its group; groups are numbered in the order their first voxel is met
+    vector<size_t> voxels;
+    vector<int> group;
+    vector<int> sizes;
+
+private:
+    struct Offset
+    {
+        int di, dj;
+        bool below;     // in the slice below, else in this slice
+    };
+
+    int root(int l);
+    void unite(int a, int b);
+
+    double threshold;
+    vector<Offset> before;      // neighbours that come earlier in scan order
+    vector<int> parent;
+    vector<int> prevLabels;     //labels of slice lastSlice, -1 below the threshold
+    vector<int> labels;
+    int lastSlice;
+};
+
+VoxelComponents::VoxelComponents(double threshold, Connectivity connect) : threshold(threshold), lastSlice(-2)
+{
+    //a neighbour is |di| + |dj| + |dk| <= 1, 2 or 3 steps away
+    int reach = connect == CONNECT_6 ? 1 : connect == CONNECT_18 ? 2 : 3;
+    for (int dk = -1; dk <= 0; dk++)
+        for (int dj = -1; dj <= 1; dj++)
+            for (int di = -1; di <= 1; di++)
+            {
+                bool earlier = dk < 0 || dj < 0 || (dj == 0 && di < 0);
+                if (earlier && abs(di) + abs(dj) + abs(dk) <= reach)
+                {
+                    Offset o = {di, dj, dk < 0};
+                    before.push_back(o);
+                }
+            }
+}
+
+void VoxelComponents::addSlice(const float* slice, int nx, int ny, int k)
+{
+    bool below = lastSlice == k-1;
+    labels.assign((size_t)nx*ny, -1);
+
+    for (int j = 0; j < ny; j++)
+        for (int i = 0; i < nx; i++)
+        {
+            if (!(slice[i + (size_t)nx*j] > threshold))
+                continue;
+
+            int l = -1;
+            for (int o = 0; o < before.size(); o++)
+            {
+                int ni = i + before[o].di, nj = j + before[o].dj;
+                if (ni < 0 || nj < 0 || ni >= nx || nj >= ny || (before[o].below && !below))
+                    continue;
+                int n = (before[o].below ? prevLabels : labels)[ni + (size_t)nx*nj];
+                if (n < 0)
+                    continue;
+                if (l < 0) l = n;
+                else unite(l, n);
+            }
+
+            if (l < 0)
+            {
+                l = parent.size();
+                parent.push_back(l);
+            }
+            labels[i + (size_t)nx*j] = l;
+            voxels.push_back(i + (size_t)nx*(j + (size_t)ny*k));
+            group.push_back(l);
+        }
+
+    prevLabels.swap(labels);
+    lastSlice = k;
+}
+
+void VoxelComponents::add(const VoxelGrid<float> &grid)
+{
+    for (int k = 0; k < grid.numSlcs(); k++)
+        addSlice(&grid(0, 0, k), grid.numRows(), grid.numCols(), k);
+}
+
+int VoxelComponents::finish(int minSize)
+{
+    //number the roots in the order they are met and count their voxels
+    vector<int> number(parent.size(), -1);
+    vector<int> count;
+    for (size_t n = 0; n < group.size(); n++)
+    {
+        int r = root(group[n]);
+        if (number[r] < 0)
+        {
+            number[r] = count.size();
+            count.push_back(0);
+        }
+        group[n] = number[r];
+        count[number[r]]++;
+    }
+    vector<int>().swap(parent);
+
+    //renumber what is left after the small groups are dropped, keeping the order
+    vector<int> kept(count.size(), -1);
+    sizes.clear();
+    for (int g = 0; g < count.size(); g++)
+        if (count[g] >= minSize)
+        {
+            kept[g] = sizes.size();
+            sizes.push_back(count[g]);
+        }
+
+    size_t m = 0;
+    for (size_t n = 0; n < group.size(); n++)
+        if (kept[group[n]] >= 0)
+        {
+            voxels[m] = voxels[n];
+            group[m] = kept[group[n]];
+            m++;
+        }
+    voxels.resize(m);
+    group.resize(m);
+
+    return sizes.size();
+}
+
+void VoxelComponents::flush(function<void(const vector<size_t>&)> emit, int minSize, bool all)
+{
+    //the groups that reach the last slice stay, numbered in the order they are met there
+    vector<int> open(parent.size(), -1);
+    int numOpen = 0;
+    if (!all)
+        for (size_t n = 0; n < prevLabels.size(); n++)
+            if (prevLabels[n] >= 0)
+            {
+                int r = root(prevLabels[n]);
+                if (open[r] < 0)
+                    open[r] = numOpen++;
+            }
+
+    //the rest are done, numbered in the order their first voxel is met
+    vector<int> closed(parent.size(), -1);
+    vector<vector<size_t> > done;
+    size_t m = 0;
+    for (size_t n = 0; n < group.size(); n++)
+    {
+        int r = root(group[n]);
+        if (open[r] >= 0)
+        {
+            voxels[m] = voxels[n];
+            group[m] = open[r];
+            m++;
+            continue;
+        }
+        if (closed[r] < 0)
+        {
+            closed[r] = done.size();
+            done.push_back(vector<size_t>());
+        }
+        done[closed[r]].push_back(voxels[n]);
+    }
+    voxels.resize(m);
+    group.resize(m);
+
+    for (size_t n = 0; n < prevLabels.size(); n++)
+        if (prevLabels[n] >= 0)
+            prevLabels[n] = open[root(prevLabels[n])];
+    parent.resize(numOpen);
+    for (int l = 0; l < numOpen; l++)
+        parent[l] = l;
+
+    for (int g = 0; g < done.size(); g++)
+        if (done[g].size() >= minSize)
+            emit(done[g]);
+}
+
+void VoxelComponents::labelMap(vector<int> &label, size_t count) const
+{
+    label.assign(count, -1);
+    for (size_t n = 0; n < voxels.size(); n++)
+        label[voxels[n]] = group[n];
+}
+
+int VoxelComponents::root(int l)
+{
+    while (parent[l] != l)
+    {
+        parent[l] = parent[parent[l]];
+        l = parent[l];
+    }
+    return l;
+}
+
+void VoxelComponents::unite(int a, int b)
+{
+    a = root(a);
+    b = root(b);
+    if (a < b)
+        parent[b] = a;
+    else if (b < a)
+        parent[a] = b;
+}
+
+// The voxels of every group in one shared array, group by group (compressed rows), so a group is
+// gone through without a pass over the map. Within a group the voxels stay in scan order.
+class GroupVoxels{
+public:
+    explicit GroupVoxels(int first = 0) : start(first, 0), length(first, 0) {}     //first empty groups
+    // the groups of a finished VoxelComponents as groups first, first+1, ...; the ones below first are empty
+    explicit GroupVoxels(const VoxelComponents &components, int first = 0);
+
+    inline int count() const {return start.size();}                 //number of groups
+    inline int size(int g) const {return length[g];}
+    inline size_t voxel(int g, int n) const {return voxels[start[g] + n];}      //index in the map of the n-th voxel of g
+
+    // Moves the voxels of group g for which move(voxel) is true into a new group at the end and
+    // returns it; g < 0 just adds an empty group.
+    template <typename Pred>
+    int split(int g, Pred move);
+
+    int add(const vector<size_t> &groupVoxels);     //a new group at the end with these voxels, returned
+    // puts groups first, first+1, ... in the order of their first voxel, as the groups of a finished
+    // VoxelComponents are numbered; the voxels of each group must be in scan order
+    void sortByFirstVoxel(int first = 0);
+
+private:
+    vector<size_t> start;
+    vector<int> length;
+    vector<size_t> voxels;
+};
+
+GroupVoxels::GroupVoxels(const VoxelComponents &components, int first) : start(first, 0), length(first, 0), voxels(components.voxels.size())
+{
+    //counting sort by group, stable so scan order is kept
+    size_t s = 0;
+    for (int g = 0; g < components.sizes.size(); g++)
+    {
+        start.push_back(s);
+        length.push_back(0);
+        s += components.sizes[g];
+    }
+    for (size_t n = 0; n < components.voxels.size(); n++)
+    {
+        int g = first + components.group[n];
+        voxels[start[g] + length[g]++] = components.voxels[n];
+    }
+}
+
+template <typename Pred>
+int GroupVoxels::split(int g, Pred move)
+{
+    int added = count();
+    start.push_back(voxels.size());
+    length.push_back(0);
+    if (g < 0)
+        return added;
+
+    int kept = 0;
+    for (int n = 0; n < length[g]; n++)
+    {
+        size_t v = voxels[start[g] + n];
+        if (move(v))
+        {
+            voxels.push_back(v);
+            length[added]++;
+        }
+        else
+            voxels[start[g] + kept++] = v;
+    }
+    length[g] = kept;
+    return added;
+}
+
+int GroupVoxels::add(const vector<size_t> &groupVoxels)
+{
+    start.push_back(voxels.size());
+    length.push_back(groupVoxels.size());
+    voxels.insert(voxels.end(), groupVoxels.begin(), groupVoxels.end());
+    return count()-1;
+}
+
+void GroupVoxels::sortByFirstVoxel(int first)
+{
+    //only the group table moves, the voxels stay where they are
+    vector<int> order;
+    for (int g = first; g < count(); g++)
+        order.push_back(g);
+    sort(order.begin(), order.end(), [&](int a, int b)
+    {
+        if (length[a] == 0 || length[b] == 0)
+            return length[a] > length[b];
+        return voxels[start[a]] < voxels[start[b]];
+    });
+
+    vector<size_t> oldStart(start);
+    vector<int> oldLength(length);
+    for (int n = 0; n < order.size(); n++)
+    {
+        start[first + n] = oldStart[order[n]];
+        length[first + n] = oldLength[order[n]];
+    }
+}
+
+#endif // COMPONENTS_H_INCLUDED
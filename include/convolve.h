@@ -0,0 +1,188 @@
+#ifndef CONVOLVE_H_INCLUDED
+#define CONVOLVE_H_INCLUDED
+
+#include <vector>
+#include <math.h>
+#include "voxelgrid.h"
+#include "threadpool.h"
+
+// What a separable filter does near the edges of the grid.
+enum BorderPolicy
+{
+    BORDER_KEEP,        // voxels closer to the edge than the radius keep their value
+    BORDER_CLAMP,       // every voxel is filtered, the window repeats the edge voxel
+    BORDER_MIRROR,      // ... reflects about the edge voxel
+    BORDER_ZERO         // ... reads zeros outside the grid
+};
+
+// A symmetric 1D kernel applied along x, y and z in turn. Every pass reads from a copy of the lines
+// it writes, so no voxel sees a value already filtered by the same pass. The inner loops run along
+// the contiguous x axis; apply() splits the slices (x and y passes) and the rows (z pass) between
+// the threads of the pool.
+//
+// T only needs T(), T + T and T * float, so the same code smooths densities and tensor entries.
+class SeparableFilter{
+public:
+    SeparableFilter(const float* weights, int count) : taps(weights, weights + count) {}
+
+    // sampled gaussian of the given sigma (in voxels), radius ceil(3 sigma), weights sum to 1
+    static SeparableFilter gaussian(float sigma)
+    {
+        int r = max((int)ceil(3*sigma), 1);
+        vector<float> w(2*r+1);
+        float sum = 0;
+        for (int t = -r; t <= r; t++)
+        {
+            w[t+r] = exp(-(t*t)/(2*sigma*sigma));
+            sum += w[t+r];
+        }
+        for (int t = 0; t < 2*r+1; t++)
+            w[t] /= sum;
+        return SeparableFilter(w.data(), w.size());
+    }
+
+    inline int radius() const {return taps.size()/2;}
+    inline int size() const {return taps.size();}
+
+    // width of the outer shell that is left untouched: the radius for BORDER_KEEP, at least margin
+    inline int shell(BorderPolicy border, int margin) const {return border == BORDER_KEEP ? max(radius(), margin) : margin;}
+
+    // voxel a window position p reads on a line of n voxels, -1 for zero
+    int source(int p, int n, BorderPolicy border) const
+    {
+        if (p >= 0 && p < n)
+            return p;
+        if (border == BORDER_MIRROR)
+            p = p < 0 ? -p : 2*(n-1) - p;
+        if (border == BORDER_CLAMP || border == BORDER_MIRROR)
+            return min(max(p, 0), n-1);
+        return -1;
+    }
+
+    // out[i] = sum over t of weight t * in[t][i] for i in [from, to); a null in[t] reads as zero.
+    // Runs 8 voxels at a time in a local accumulator, which the compiler turns into vector code.
+    template <typename T>
+    void weightedSum(const T* const* in, T* out, int from, int to) const
+    {
+        int i = from;
+        for (; i + 8 <= to; i += 8)
+        {
+            T acc[8];
+            for (int l = 0; l < 8; l++)
+                acc[l] = T();
+            for (int t = 0; t < size(); t++)
+                if (in[t])
+                {
+                    const T* v = in[t] + i;
+                    float w = taps[t];
+                    for (int l = 0; l < 8; l++)
+                        acc[l] = acc[l] + v[l] * w;
+                }
+            for (int l = 0; l < 8; l++)
+                out[i+l] = acc[l];
+        }
+        for (; i < to; i++)
+        {
+            T acc = T();
+            for (int t = 0; t < size(); t++)
+                if (in[t])
+                    acc = acc + in[t][i] * taps[t];
+            out[i] = acc;
+        }
+    }
+
+    // x and y passes over slice k of an nx * ny * nz grid, in place; scratch is reused between calls
+    template <typename T>
+    void applySliceXY(T* slc, int nx, int ny, int k, int nz, BorderPolicy border, int margin, vector<T> &scratch) const
+    {
+        int s = shell(border, margin), r = radius();
+        if (k < s || k >= nz - s || nx - s <= s || ny - s <= s)
+            return;
+
+        vector<const T*> in(size());
+        scratch.resize(max((size_t)nx*ny, (size_t)nx + 2*r));
+
+        // along x, from a padded copy of the row
+        for (int j = s; j < ny - s; j++)
+        {
+            T* row = slc + (size_t)nx*j;
+            for (int p = -r; p < nx + r; p++)
+            {
+                int q = source(p, nx, border);
+                scratch[p+r] = q < 0 ? T() : row[q];
+            }
+            for (int t = 0; t < size(); t++)
+                in[t] = scratch.data() + t;     // in[t][i] is the voxel at i+t-r
+            weightedSum(in.data(), row, s, nx - s);
+        }
+
+        // along y, from a copy of the slice
+        copy(slc, slc + (size_t)nx*ny, scratch.begin());
+        for (int j = s; j < ny - s; j++)
+        {
+            for (int t = 0; t < size(); t++)
+            {
+                int q = source(j + t - r, ny, border);
+                in[t] = q < 0 ? 0 : scratch.data() + (size_t)nx*q;
+            }
+            weightedSum(in.data(), slc + (size_t)nx*j, s, nx - s);
+        }
+    }
+
+    // z pass for one slice: in[t] is slice k+t-radius() before the z pass (null for zero), out is slice k
+    template <typename T>
+    void applySliceZ(const T* const* in, T* out, int nx, int ny, int k, int nz, BorderPolicy border, int margin) const
+    {
+        int s = shell(border, margin);
+        if (k < s || k >= nz - s)
+            return;
+        vector<const T*> row(size());
+        for (int j = s; j < ny - s; j++)
+        {
+            for (int t = 0; t < size(); t++)
+                row[t] = in[t] ? in[t] + (size_t)nx*j : 0;
+            weightedSum(row.data(), out + (size_t)nx*j, s, nx - s);
+        }
+    }
+
+    template <typename T>
+    void apply(VoxelGrid<T> &grid, ThreadPool &pool, BorderPolicy border = BORDER_CLAMP, int margin = 0) const
+    {
+        int nx = grid.numRows(), ny = grid.numCols(), nz = grid.numSlcs();
+        int s = shell(border, margin), r = radius();
+        int chunks = pool.size();
+
+        pool.parallelFor(chunks, [&](int c)
+        {
+            vector<T> scratch;
+            for (int k = c*nz/chunks; k < (c+1)*nz/chunks; k++)
+                applySliceXY(&grid(0, 0, k), nx, ny, k, nz, border, margin, scratch);
+        });
+
+        // along z, one x-z plane at a time from a copy of it
+        pool.parallelFor(chunks, [&](int c)
+        {
+            vector<T> plane((size_t)nx*nz);
+            vector<const T*> in(size());
+            for (int j = max(c*ny/chunks, s); j < min((c+1)*ny/chunks, ny - s); j++)
+            {
+                for (int k = 0; k < nz; k++)
+                    copy(&grid(0, j, k), &grid(0, j, k) + nx, plane.begin() + (size_t)nx*k);
+                for (int k = s; k < nz - s; k++)
+                {
+                    for (int t = 0; t < size(); t++)
+                    {
+                        int q = source(k + t - r, nz, border);
+                        in[t] = q < 0 ? 0 : plane.data() + (size_t)nx*q;
+                    }
+                    weightedSum(in.data(), &grid(0, j, k), s, nx - s);
+                }
+            }
+        });
+    }
+
+private:
+    vector<float> taps;
+};
+
+#endif // CONVOLVE_H_INCLUDED
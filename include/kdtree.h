@@ -0,0 +1,189 @@
+#ifndef KDTREE_H_INCLUDED
+#define KDTREE_H_INCLUDED
+
+#include <vector>
+#include <algorithm>
+#include "pointsoa.h"
+
+// Bucketed KD-tree over a fixed set of points for nearest-neighbour queries.
+// Build once with build(), then query as often as needed. Ties resolve to the
+// lowest point index so results match a front-to-back brute force scan, or to
+// the highest with preferLast, matching a back-to-front scan.
+class KDTree{
+public:
+    KDTree() : numPoints(0) {}
+
+    void build(const vector<Coordinate> &points);
+    void clear();
+    inline int size() const {return numPoints;}
+    inline bool empty() const {return numPoints == 0;}
+
+    int nearest(const Coordinate &c, double &distanceSq, bool preferLast = false) const;   // index of the closest point, -1 when empty
+
+private:
+    struct KDNode
+    {
+        int begin, end;         // range in pointIndex
+        int left, right;        // children, -1 for a leaf
+        int splitAxis;
+        double split;
+    };
+
+    int buildNode(const vector<Coordinate> &points, int begin, int end);
+    void lastClosestIndex(int begin, int end, const Coordinate &c, int &best, double &bestSq) const;
+    static inline double component(const Coordinate &c, int axis) {return axis == 0 ? c.x : (axis == 1 ? c.y : c.z);}
+
+    static const int bucketSize = 16;
+
+    int numPoints;
+    vector<KDNode> nodes;
+    vector<int> pointIndex;         // original point index, grouped by leaf
+    PointsSoA leafPoints;           // coordinates in pointIndex order, scanned with the vector kernel
+};
+
+void KDTree::clear()
+{
+    numPoints = 0;
+    nodes.clear();
+    pointIndex.clear();
+    leafPoints.clear();
+}
+
+void KDTree::build(const vector<Coordinate> &points)
+{
+    clear();
+    numPoints = points.size();
+    if (numPoints == 0)
+        return;
+
+    pointIndex.resize(numPoints);
+    for (int i = 0; i < numPoints; i++)
+        pointIndex[i] = i;
+
+    nodes.reserve(2*numPoints/bucketSize + 1);
+    buildNode(points, 0, numPoints);
+
+    // keep each bucket in index order so the first minimum in a leaf is also the lowest index
+    leafPoints.reserve(numPoints);
+    for (int n = 0; n < nodes.size(); n++)
+        if (nodes[n].left < 0)
+            sort(pointIndex.begin()+nodes[n].begin, pointIndex.begin()+nodes[n].end);
+    for (int i = 0; i < numPoints; i++)
+        leafPoints.push_back(points[pointIndex[i]]);
+}
+
+int KDTree::buildNode(const vector<Coordinate> &points, int begin, int end)
+{
+    KDNode node;
+    node.begin = begin;
+    node.end = end;
+    node.left = -1;
+    node.right = -1;
+    node.splitAxis = 0;
+    node.split = 0;
+
+    int current = nodes.size();
+    nodes.push_back(node);
+    if (end - begin <= bucketSize)
+        return current;
+
+    // split the widest extent at its median
+    Coordinate low = points[pointIndex[begin]];
+    Coordinate high = low;
+    for (int i = begin+1; i < end; i++)
+    {
+        const Coordinate &c = points[pointIndex[i]];
+        low.x = min(low.x, c.x); high.x = max(high.x, c.x);
+        low.y = min(low.y, c.y); high.y = max(high.y, c.y);
+        low.z = min(low.z, c.z); high.z = max(high.z, c.z);
+    }
+    int axis = 0;
+    if (high.y - low.y > high.x - low.x)
+        axis = 1;
+    if (high.z - low.z > max(high.x - low.x, high.y - low.y))
+        axis = 2;
+
+    int middle = begin + (end - begin)/2;
+    nth_element(pointIndex.begin()+begin, pointIndex.begin()+middle, pointIndex.begin()+end,
+                [&points, axis](int a, int b) {return component(points[a], axis) < component(points[b], axis);});
+
+    nodes[current].splitAxis = axis;
+    nodes[current].split = component(points[pointIndex[middle]], axis);
+    int left = buildNode(points, begin, middle);
+    int right = buildNode(points, middle, end);
+    nodes[current].left = left;
+    nodes[current].right = right;
+
+    return current;
+}
+
+// last minimum of a leaf, which is its highest point index since buckets are sorted
+void KDTree::lastClosestIndex(int begin, int end, const Coordinate &c, int &best, double &bestSq) const
+{
+    for (int i = begin; i < end; i++)
+    {
+        double dx = leafPoints.x[i] - c.x;
+        double dy = leafPoints.y[i] - c.y;
+        double dz = leafPoints.z[i] - c.z;
+        double d = dx*dx + dy*dy + dz*dz;
+        if (best < 0 || d <= bestSq)
+        {
+            bestSq = d;
+            best = i;
+        }
+    }
+}
+
+int KDTree::nearest(const Coordinate &c, double &distanceSq, bool preferLast) const
+{
+    int best = -1;
+    distanceSq = 0;
+    if (numPoints == 0)
+        return best;
+
+    double bestSq = 0;
+    int stack[64];
+    double bound[64];   // lower bound on the squared distance from c to anything under the node
+    int top = 0;
+    stack[top] = 0;
+    bound[top++] = 0;
+
+    while (top > 0)
+    {
+        top--;
+        double nodeBound = bound[top];
+        // equal distances still have to be visited so the preferred index wins ties
+        if (best >= 0 && nodeBound > bestSq)
+            continue;
+        const KDNode &node = nodes[stack[top]];
+        if (node.left < 0)
+        {
+            double d = 0;
+            int i = -1;
+            if (preferLast)
+                lastClosestIndex(node.begin, node.end, c, i, d);
+            else
+                i = closestIndex(leafPoints, node.begin, node.end, c, d);
+            if (i >= 0 && (best < 0 || d < bestSq || (d == bestSq && (preferLast ? pointIndex[i] > best : pointIndex[i] < best))))
+            {
+                bestSq = d;
+                best = pointIndex[i];
+            }
+            continue;
+        }
+
+        double diff = component(c, node.splitAxis) - node.split;
+        int nearChild = diff < 0 ? node.left : node.right;
+        int farChild = diff < 0 ? node.right : node.left;
+
+        stack[top] = farChild;
+        bound[top++] = max(nodeBound, diff*diff);
+        stack[top] = nearChild;
+        bound[top++] = nodeBound;
+    }
+
+    distanceSq = bestSq;
+    return best;
+}
+
+#endif // KDTREE_H_INCLUDED
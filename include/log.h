@@ -0,0 +1,118 @@
+#ifndef LOG_H_INCLUDED
+#define LOG_H_INCLUDED
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <mutex>
+
+// Diagnostic logging with levels and categories.
+//
+//  LOG_WARN(LOG_DISPLACEMENT, "b = " << b);
+//
+// A statement above LOG_MAX_LEVEL (set at compile time, e.g. -DLOG_MAX_LEVEL=3) expands to nothing.
+// The rest are filtered at run time by Logger::setLevel()/setCategories(); the default only lets
+// errors and warnings through. Enabled lines are formatted into one string and written to clog
+// under a lock, so lines from different threads never interleave and nothing is flushed per line.
+
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+#define LOG_LEVEL_TRACE 5
+
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL LOG_LEVEL_TRACE
+#endif
+
+enum LogCategory
+{
+    LOG_GENERAL      = 1,
+    LOG_MATCHING     = 2,       // true/trace pairing in main()
+    LOG_DISPLACEMENT = 4,       // Axis::findDisplacement and friends
+    LOG_MAP          = 8,       // density map processing
+    LOG_ALL_CATEGORIES = 0xFF
+};
+
+class Logger{
+public:
+    static inline int& level() {static int current = LOG_LEVEL_WARN; return current;}
+    static inline int& categories() {static int current = LOG_ALL_CATEGORIES; return current;}
+    static inline void setLevel(int l) {level() = l;}
+    static inline void setCategories(int c) {categories() = c;}
+    static inline bool enabled(int l, int category) {return l <= level() && (category & categories()) != 0;}
+
+    static void write(const string &line)
+    {
+        static mutex lock;
+        lock_guard<mutex> guard(lock);
+        clog << line << '\n';
+    }
+
+    // "none", "error", "warn", "info", "debug" or "trace"; returns false for anything else
+    static bool parseLevel(const string &name, int &l)
+    {
+        const char* names[] = {"none", "error", "warn", "info", "debug", "trace"};
+        for (int i = 0; i <= LOG_LEVEL_TRACE; i++)
+            if (name == names[i])
+            {
+                l = i;
+                return true;
+            }
+        return false;
+    }
+
+    // comma separated list of "general", "matching", "displacement", "map" or "all"
+    static bool parseCategories(const string &list, int &mask)
+    {
+        mask = 0;
+        stringstream ss(list);
+        string name;
+        while (getline(ss, name, ','))
+        {
+            if (name == "general") mask |= LOG_GENERAL;
+            else if (name == "matching") mask |= LOG_MATCHING;
+            else if (name == "displacement") mask |= LOG_DISPLACEMENT;
+            else if (name == "map") mask |= LOG_MAP;
+            else if (name == "all") mask |= LOG_ALL_CATEGORIES;
+            else return false;
+        }
+        return mask != 0;
+    }
+};
+
+#define LOG_AT(l, category, expr) \
+    do { if (Logger::enabled(l, category)) { ostringstream logLine; logLine << expr; Logger::write(logLine.str()); } } while (0)
+
+#if LOG_MAX_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(category, expr) LOG_AT(LOG_LEVEL_ERROR, category, expr)
+#else
+#define LOG_ERROR(category, expr) do {} while (0)
+#endif
+
+#if LOG_MAX_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(category, expr) LOG_AT(LOG_LEVEL_WARN, category, expr)
+#else
+#define LOG_WARN(category, expr) do {} while (0)
+#endif
+
+#if LOG_MAX_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(category, expr) LOG_AT(LOG_LEVEL_INFO, category, expr)
+#else
+#define LOG_INFO(category, expr) do {} while (0)
+#endif
+
+#if LOG_MAX_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(category, expr) LOG_AT(LOG_LEVEL_DEBUG, category, expr)
+#else
+#define LOG_DEBUG(category, expr) do {} while (0)
+#endif
+
+#if LOG_MAX_LEVEL >= LOG_LEVEL_TRACE
+#define LOG_TRACE(category, expr) LOG_AT(LOG_LEVEL_TRACE, category, expr)
+#else
+#define LOG_TRACE(category, expr) do {} while (0)
+#endif
+
+#endif // LOG_H_INCLUDED
@@ -0,0 +1,263 @@
+#ifndef MAPSTREAM_H_INCLUDED
+#define MAPSTREAM_H_INCLUDED
+
+#include <functional>
+#include "MRC.h"
+#include "components.h"
+
+// One z-slab of a streamed map: slices k0 .. k1-1, with up to halo finished slices on either side of
+// it (fewer at the ends of the map). Voxels are addressed with map coordinates, slab(i, j, k) for
+// first <= k < last.
+struct MapSlab
+{
+    int nx, ny, nz;                 // size of the whole map
+    int k0, k1;                     // slices this slab is responsible for
+    int first, last;                // slices held, halo included
+    const vxlDataType* voxels;      // slice first, x fastest as in the file
+
+    inline const vxlDataType* slice(int k) const {return voxels + (size_t)nx*ny*(k-first);}
+    inline vxlDataType operator()(int i, int j, int k) const {return voxels[i + (size_t)nx*(j + (size_t)ny*(k-first))];}
+};
+
+// Reads a density map from disk a slab of z slices at a time, for maps too large to hold as a Map
+// with its grad/tens/dt grids. normalize(), filterize() and gauss_smooth() give the same voxels as the
+// Map functions of the same name; they are applied while the slices stream past, the point steps in
+// the order they were asked for and the smoothing after them. Every finished slab is handed to the
+// caller with halo slices around it, so stencils like the gradient can run on it. Only the slab, its
+// halos and the radius of the smoothing in slices behind and ahead of it are held in memory.
+class MapStream{
+public:
+    MRC_HEADER hdr;         // as Map::hdr after Map::read
+    float apixX;
+    float apixY;
+    float apixZ;
+
+    // min, max, mean and rms of the finished voxels of the last pass, as update_hdrInfo() would set them
+    float amin;
+    float amax;
+    float amean;
+    float rms;
+
+    MapStream(string mrcFname, int slabDepth = 16);
+
+    inline int numRows() const {return hdr.nx;}
+    inline int numCols() const {return hdr.ny;}
+    inline int numSlcs() const {return hdr.nz;}
+
+    void normalize();                   //divide by hdr.amax
+    void filterize(float threshold);    //voxels below threshold become 0
+    void gauss_smooth();
+    void gauss_smooth(const SeparableFilter &filter, BorderPolicy border = BORDER_KEEP);
+
+    // Streams the whole map, calling body(slab) for each slab in z order. Can be called again, every
+    // pass reads the file from the start.
+    void forEachSlab(int halo, function<void(const MapSlab&)> body);
+
+private:
+    void loadSlices();
+    void finishSlice(int k);
+    vxlDataType* bufSlice(int k) {return &buf[(size_t)hdr.nx*hdr.ny*(k-bufFirst)];}
+
+    string fileName;
+    ifstream inMapF;
+    streampos dataStart;
+    int fileMode;
+    bool swapped;
+    int slabDepth;
+
+    VoxelPipeline steps;
+    bool smooth;
+    SeparableFilter smoothing;
+    BorderPolicy smoothBorder;
+    vector<vxlDataType> scratch;
+    vector<vxlDataType> ring;   // the last radius+1 slices before their z pass, slice k at k % (radius+1)
+
+    vector<vxlDataType> buf;    // slices bufFirst .. loaded-1, those below finished are done
+    int bufFirst;
+    int loaded;
+    int finished;
+    DensityStats stats;
+};
+
+MapStream::MapStream(string mrcFname, int slabDepth) : fileName(mrcFname), slabDepth(max(slabDepth, 1)), smooth(false),
+    smoothing(gaussWeights, 7), smoothBorder(BORDER_KEEP)
+{
+    swapped = openMRC(inMapF, mrcFname, hdr);
+    dataStart = inMapF.tellg();
+    fileMode = hdr.mode;
+
+    apixX = hdr.xlength / hdr.mx;
+    apixY = hdr.ylength / hdr.my;
+    apixZ = hdr.zlength / hdr.mz;
+
+    amin = hdr.amin;
+    amax = hdr.amax;
+    amean = hdr.amean;
+    rms = hdr.rms;
+
+    //what the slabs hold, the same as Map::read leaves it
+    hdr.mode = 2;
+    hdr.nsymbt = 0;
+    setNativeMachineStamp(hdr);
+}
+
+void MapStream::normalize()
+{
+    steps.divide(hdr.amax);
+}
+
+void MapStream::filterize(float threshold)
+{
+    steps.filter(threshold);
+}
+
+void MapStream::gauss_smooth()
+{
+    gauss_smooth(SeparableFilter(gaussWeights, 7));
+}
+
+void MapStream::gauss_smooth(const SeparableFilter &filter, BorderPolicy border)
+{
+    smooth = true;
+    smoothing = filter;
+    smoothBorder = border;
+}
+
+void MapStream::forEachSlab(int halo, function<void(const MapSlab&)> body)
+{
+    int nz = numSlcs();
+    size_t slcLen = (size_t)numRows()*numCols();
+
+    inMapF.clear();
+    inMapF.seekg(dataStart);
+    buf.clear();
+    ring.assign((size_t)slcLen*(smoothing.radius()+1), 0);
+    bufFirst = loaded = finished = 0;
+    stats = DensityStats();
+
+    for (int k0 = 0; k0 < nz; k0 += slabDepth)
+    {
+        int k1 = min(k0 + slabDepth, nz);
+        int last = min(k1 + halo, nz);
+
+        //the z pass of the smoothing needs radius more slices beyond the one it finishes
+        while (finished < last)
+        {
+            while (loaded < min(finished + 1 + (smooth ? smoothing.radius() : 0), nz))
+                loadSlices();
+            finishSlice(finished++);
+        }
+
+        MapSlab slab;
+        slab.nx = numRows();
+        slab.ny = numCols();
+        slab.nz = nz;
+        slab.k0 = k0;
+        slab.k1 = k1;
+        slab.first = max(k0 - halo, 0);
+        slab.last = last;
+        slab.voxels = bufSlice(slab.first);
+        body(slab);
+
+        //keep the next slab's lower halo, the smoothing looks back at its own copies in ring
+        int keep = max(k1 - halo, bufFirst);
+        buf.erase(buf.begin(), buf.begin() + slcLen*(keep - bufFirst));
+        bufFirst = keep;
+    }
+
+    amin = stats.amin;
+    amax = stats.amax;
+    amean = stats.mean();
+    rms = stats.rms();
+}
+
+// reads the next slabDepth slices, applies the point steps and the in-slice part of the smoothing
+void MapStream::loadSlices()
+{
+    int nx = numRows(), ny = numCols(), nz = numSlcs();
+    int n = min(slabDepth, nz - loaded);
+    size_t slcLen = (size_t)nx*ny;
+
+    buf.resize(buf.size() + slcLen*n);
+    vxlDataType* v = bufSlice(loaded);
+    if (!readVoxelBlock(inMapF, fileMode, swapped, v, slcLen*n))
+    {
+        cout<<"============================== in MapStream (string) =========================="<<endl;
+        cout<<"Map file ( "<<fileName<<" ) ends before all "<<slcLen*nz<<" voxels were read."<<endl;
+        cout<<"==============================================================================="<<endl;
+        exit(1);
+    }
+
+    steps.run(v, slcLen*n);
+
+    if (smooth)
+        for (int k = loaded; k < loaded + n; k++)
+            smoothing.applySliceXY(bufSlice(k), nx, ny, k, nz, smoothBorder, 0, scratch);
+
+    loaded += n;
+}
+
+void MapStream::finishSlice(int k)
+{
+    int nx = numRows(), ny = numCols();
+
+    if (smooth)
+    {
+        //slices up to k come from their copies before the z pass, the ones above are not done yet
+        int r = smoothing.radius();
+        size_t slcLen = (size_t)nx*ny;
+        copy(bufSlice(k), bufSlice(k) + slcLen, ring.begin() + slcLen*(k % (r+1)));
+
+        vector<const vxlDataType*> in(smoothing.size());
+        for (int t = 0; t < smoothing.size(); t++)
+        {
+            int q = smoothing.source(k + t - r, numSlcs(), smoothBorder);
+            in[t] = q < 0 ? 0 : q > k ? bufSlice(q) : &ring[slcLen*(q % (r+1))];
+        }
+        smoothing.applySliceZ(in.data(), bufSlice(k), nx, ny, k, numSlcs(), smoothBorder, 0);
+    }
+
+    stats.add(bufSlice(k), (size_t)nx*ny);
+}
+
+
+// Gradient of the slices k0 .. k1-1 of a slab, as Map::buildGradient computes them. Needs a halo of 1.
+// grad gets one slice per slab slice; the border of the map is left at 0 as in buildGradient.
+void slabGradient(const MapSlab &slab, int fast, VoxelGrid<Gradient> &grad)
+{
+    GradientMasks masks;
+
+    grad.resize(slab.nx, slab.ny, slab.k1 - slab.k0);
+    for (int k = max(slab.k0, 1); k < min(slab.k1, slab.nz - 1); k++)
+        for (int j = 1; j < slab.ny - 1; j++)
+            for (int i = 1; i < slab.nx - 1; i++)
+                voxelGradient(slab, i, j, k, fast, masks, grad(i, j, k - slab.k0));
+}
+
+
+// Groups of touching voxels above a threshold, built slab by slab. A group that crosses a slab
+// boundary is merged with its part in the slab before through the labels of the last slice. After
+// every slab the groups that end in it go to emit and are forgotten, so only the groups that reach
+// the last slice are held. Groups come in the order they end; GroupVoxels::sortByFirstVoxel() puts
+// them in the order VoxelComponents numbers them.
+class SlabComponents : public VoxelComponents{
+public:
+    typedef function<void(const vector<size_t>&)> Emit;
+
+    SlabComponents(float threshold, Emit emit, int minSize = 1, Connectivity connect = CONNECT_26) :
+        VoxelComponents(threshold, connect), emit(emit), minSize(minSize) {}
+
+    void add(const MapSlab &slab)       //slabs must come in z order
+    {
+        for (int k = slab.k0; k < slab.k1; k++)
+            addSlice(slab.slice(k), slab.nx, slab.ny, k);
+        flush(emit, minSize);
+    }
+    void finish() {flush(emit, minSize, true);}      //after the last slab, hands on the groups left
+
+private:
+    Emit emit;
+    int minSize;
+};
+
+#endif // MAPSTREAM_H_INCLUDED
@@ -0,0 +1,252 @@
+#ifndef MATCHING_H_INCLUDED
+#define MATCHING_H_INCLUDED
+
+#include <vector>
+#include <limits>
+#include "axis.h"
+#include "threadpool.h"
+
+// midpoint of the two axis ends; the matching phase gates pairs on the distance between centers
+Coordinate axisCenter(Axis &a)
+{
+    Coordinate center;
+    center.x = (a.axisPoints[0].x + a.axisPoints[a.axisPoints.size()-1].x)/2;
+    center.y = (a.axisPoints[0].y + a.axisPoints[a.axisPoints.size()-1].y)/2;
+    center.z = (a.axisPoints[0].z + a.axisPoints[a.axisPoints.size()-1].z)/2;
+    return center;
+}
+
+// Displacements between true axes and traces, each pair evaluated at most once and kept for
+// the rest of the matching phase. Pairs are queued with addPair(), computed in parallel by
+// evaluate(), and read back with get(); a pair that was never queued is computed on first get().
+// Traces are compared through the view alignDirectionHels gives them, so they are only ever read.
+// Every pair has its own slot, so the values never depend on how many threads computed them.
+class DisplacementMatrix{
+public:
+    DisplacementMatrix(vector<Axis>* trueAxes, vector<Axis>* traces, double stepSize);
+
+    void addPair(int trueIndex, int traceIndex);
+    void evaluate(ThreadPool &pool);
+    Displacement get(int trueIndex, int traceIndex);
+
+private:
+    Displacement compute(int trueIndex, int traceIndex);
+
+    vector<Axis>* trueAxes;
+    vector<Axis>* traces;
+    double stepSize;
+
+    int numTraces;
+    vector<Displacement> values;    // trueIndex*numTraces + traceIndex
+    vector<char> state;             // 0 = not requested, 1 = queued, 2 = evaluated
+    vector<int> queued;
+};
+
+DisplacementMatrix::DisplacementMatrix(vector<Axis>* trueAxes, vector<Axis>* traces, double stepSize)
+{
+    this->trueAxes = trueAxes;
+    this->traces = traces;
+    this->stepSize = stepSize;
+    numTraces = traces->size();
+    values.resize(trueAxes->size()*numTraces);
+    state.resize(trueAxes->size()*numTraces, 0);
+}
+
+void DisplacementMatrix::addPair(int trueIndex, int traceIndex)
+{
+    int pair = trueIndex*numTraces + traceIndex;
+    if (state[pair] == 0)
+    {
+        state[pair] = 1;
+        queued.push_back(pair);
+    }
+}
+
+Displacement DisplacementMatrix::compute(int trueIndex, int traceIndex)
+{
+    Axis &p = trueAxes->at(trueIndex);
+    return p.findDisplacement(p.alignDirectionHels(&traces->at(traceIndex)), stepSize);
+}
+
+void DisplacementMatrix::evaluate(ThreadPool &pool)
+{
+    // drop pairs that get() already computed since they were queued
+    int kept = 0;
+    for (int n = 0; n < queued.size(); n++)
+        if (state[queued[n]] == 1)
+            queued[kept++] = queued[n];
+    queued.resize(kept);
+    if (queued.empty())
+        return;
+
+    // the axes are only read from here on, so fill their lazy caches before sharing them
+    vector<bool> trueUsed(trueAxes->size(), false);
+    vector<bool> traceUsed(numTraces, false);
+    for (int n = 0; n < queued.size(); n++)
+    {
+        trueUsed[queued[n]/numTraces] = true;
+        traceUsed[queued[n]%numTraces] = true;
+    }
+    for (int i = 0; i < trueUsed.size(); i++)
+        if (trueUsed[i])
+            trueAxes->at(i).buildCaches();
+    for (int i = 0; i < numTraces; i++)
+        if (traceUsed[i])
+            traces->at(i).buildCaches();
+
+    pool.parallelFor(queued.size(), [&](int n)
+    {
+        values[queued[n]] = compute(queued[n]/numTraces, queued[n]%numTraces);
+    });
+
+    for (int n = 0; n < queued.size(); n++)
+        state[queued[n]] = 2;
+    queued.clear();
+}
+
+Displacement DisplacementMatrix::get(int trueIndex, int traceIndex)
+{
+    int pair = trueIndex*numTraces + traceIndex;
+    if (state[pair] != 2)
+    {
+        values[pair] = compute(trueIndex, traceIndex);
+        state[pair] = 2;
+    }
+    return values[pair];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Minimum-cost assignment of rows to columns (Hungarian method with potentials, O(n^3)).
+// cost may be rectangular; it is padded to square with forbiddenCost. Returns the column
+// given to each row, or -1 when the row is left unassigned or only fits a forbidden entry.
+vector<int> hungarianAssignment(const vector<vector<double> > &cost, double forbiddenCost)
+{
+    int rows = cost.size();
+    int cols = rows > 0 ? cost[0].size() : 0;
+    int n = max(rows, cols);
+    vector<int> assigned(rows, -1);
+    if (rows == 0 || cols == 0)
+        return assigned;
+
+    const double inf = numeric_limits<double>::infinity();
+    vector<double> u(n+1, 0), v(n+1, 0), minv(n+1);
+    vector<int> p(n+1, 0), way(n+1, 0);
+    vector<bool> used(n+1);
+
+    for (int i = 1; i <= n; i++)
+    {
+        p[0] = i;
+        int j0 = 0;
+        fill(minv.begin(), minv.end(), inf);
+        fill(used.begin(), used.end(), false);
+        do
+        {
+            used[j0] = true;
+            int i0 = p[j0];
+            int j1 = 0;
+            double delta = inf;
+            for (int j = 1; j <= n; j++)
+                if (!used[j])
+                {
+                    double c = (i0 <= rows && j <= cols) ? cost[i0-1][j-1] : forbiddenCost;
+                    double current = c - u[i0] - v[j];
+                    if (current < minv[j])
+                    {
+                        minv[j] = current;
+                        way[j] = j0;
+                    }
+                    if (minv[j] < delta)
+                    {
+                        delta = minv[j];
+                        j1 = j;
+                    }
+                }
+            for (int j = 0; j <= n; j++)
+                if (used[j])
+                {
+                    u[p[j]] += delta;
+                    v[j] -= delta;
+                }
+                else
+                    minv[j] -= delta;
+            j0 = j1;
+        } while (p[j0] != 0);
+
+        do
+        {
+            int j1 = way[j0];
+            p[j0] = p[j1];
+            j0 = j1;
+        } while (j0 != 0);
+    }
+
+    for (int j = 1; j <= cols; j++)
+        if (p[j] >= 1 && p[j] <= rows && cost[p[j]-1][j-1] < forbiddenCost)
+            assigned[p[j]-1] = j-1;
+
+    return assigned;
+}
+
+// Globally optimal alternative to the greedy matching in main(). The cost of a pair is its cross
+// displacement, or the center distance for short helices, with the same cutoffs the greedy pass
+// uses (center distance below comparedDistance, cost below 3.0) and everything else forbidden.
+// Fills the same arrays as the greedy pass; alternates are the best unassigned trace under 1.5.
+void assignOptimal(DisplacementMatrix &displacements, vector<Axis> &trueAxes, vector<Axis> &traces, int numTrue, int numTraces,
+                   vector<bool> &shortHelix, double comparedDistance, int matchedHels[], double shortHels[],
+                   int matchedAlternate[], double AlternateLateral[], double AlternateLongitudinal[])
+{
+    const double maxCost = 3.0;
+    const double forbiddenCost = 1e6;
+    vector<vector<double> > cost(numTrue, vector<double>(numTraces, forbiddenCost));
+    vector<vector<double> > centerDistance(numTrue, vector<double>(numTraces, 0));
+
+    for (int i = 0; i < numTrue; i++)
+    {
+        Coordinate trueCenter = axisCenter(trueAxes[i]);
+        for (int j = 0; j < numTraces; j++)
+        {
+            centerDistance[i][j] = getDistance(trueCenter, axisCenter(traces[j]));
+            if (shortHelix[i] == true && centerDistance[i][j] < maxCost)
+                cost[i][j] = centerDistance[i][j];
+            else if (shortHelix[i] == false && centerDistance[i][j] < comparedDistance)
+            {
+                double crossDisplace = displacements.get(i, j).crossDisplace;
+                if (crossDisplace < maxCost)
+                    cost[i][j] = crossDisplace;
+            }
+        }
+    }
+
+    vector<int> assigned = hungarianAssignment(cost, forbiddenCost);
+    vector<bool> traceTaken(numTraces, false);
+    for (int i = 0; i < numTrue; i++)
+    {
+        matchedHels[i] = 99999;
+        matchedAlternate[i] = 99999;
+        AlternateLateral[i] = 99999;
+        AlternateLongitudinal[i] = 99999;
+        shortHels[i] = -1;
+        if (assigned[i] >= 0)
+        {
+            matchedHels[i] = assigned[i];
+            traceTaken[assigned[i]] = true;
+            if (shortHelix[i] == true)
+                shortHels[i] = centerDistance[i][assigned[i]];
+        }
+    }
+
+    for (int i = 0; i < numTrue; i++)
+    {
+        if (matchedHels[i] == 99999 || shortHelix[i] == true)
+            continue;
+        for (int j = 0; j < numTraces; j++)
+            if (traceTaken[j] == false && cost[i][j] < 1.5 && (matchedAlternate[i] == 99999 || cost[i][j] < AlternateLateral[i]))
+            {
+                matchedAlternate[i] = j;
+                AlternateLateral[i] = cost[i][j];
+                AlternateLongitudinal[i] = displacements.get(i, j).longDisplace;
+            }
+    }
+}
+
+#endif // MATCHING_H_INCLUDED
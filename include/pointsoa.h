@@ -0,0 +1,150 @@
+#ifndef POINTSOA_H_INCLUDED
+#define POINTSOA_H_INCLUDED
+
+#include <vector>
+#include <limits>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Structure-of-arrays copy of a point list: x, y and z each live in their own
+// contiguous array so the distance kernel below can load several points per
+// instruction.
+struct PointsSoA
+{
+    vector<double> x, y, z;
+
+    inline int size() const {return x.size();}
+    inline bool empty() const {return x.empty();}
+    inline void clear() {x.clear(); y.clear(); z.clear();}
+    inline void reserve(int n) {x.reserve(n); y.reserve(n); z.reserve(n);}
+    inline void push_back(const Coordinate &c) {x.push_back(c.x); y.push_back(c.y); z.push_back(c.z);}
+    inline Coordinate at(int i) const
+    {
+        Coordinate c;
+        c.x = x[i];
+        c.y = y[i];
+        c.z = z[i];
+        return c;
+    }
+
+    void assign(const vector<Coordinate> &points)
+    {
+        clear();
+        reserve(points.size());
+        for (int i = 0; i < points.size(); i++)
+            push_back(points[i]);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+// scalar argmin over [begin, end), used for the tails of the vector loops
+inline void closestIndexScalar(const PointsSoA &pts, int begin, int end, const Coordinate &c, int &best, double &bestSq)
+{
+    for (int i = begin; i < end; i++)
+    {
+        double dx = pts.x[i] - c.x;
+        double dy = pts.y[i] - c.y;
+        double dz = pts.z[i] - c.z;
+        double d = dx*dx + dy*dy + dz*dz;
+        if (best < 0 || d < bestSq)
+        {
+            bestSq = d;
+            best = i;
+        }
+    }
+}
+
+// First index in [begin, end) with the smallest squared distance to c, -1 if the range is empty.
+// Each lane keeps its own running minimum and the index it came from, updating only on a strict
+// improvement, so every lane holds its first minimum. Lanes are merged preferring the lower index.
+#if defined(__AVX__)
+int closestIndex(const PointsSoA &pts, int begin, int end, const Coordinate &c, double &distanceSq)
+{
+    int best = -1;
+    distanceSq = 0;
+    int i = begin;
+    if (end - begin >= 4)
+    {
+        const __m256d cx = _mm256_set1_pd(c.x), cy = _mm256_set1_pd(c.y), cz = _mm256_set1_pd(c.z);
+        const __m256d step = _mm256_set1_pd(4);
+        __m256d index = _mm256_set_pd(i+3, i+2, i+1, i);
+        __m256d bestD = _mm256_set1_pd(numeric_limits<double>::infinity());
+        __m256d bestI = _mm256_set1_pd(-1);
+        for (; i + 4 <= end; i += 4)
+        {
+            __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(&pts.x[i]), cx);
+            __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(&pts.y[i]), cy);
+            __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(&pts.z[i]), cz);
+            __m256d d = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+            __m256d better = _mm256_cmp_pd(d, bestD, _CMP_LT_OQ);
+            bestD = _mm256_blendv_pd(bestD, d, better);
+            bestI = _mm256_blendv_pd(bestI, index, better);
+            index = _mm256_add_pd(index, step);
+        }
+        double laneD[4], laneI[4];
+        _mm256_storeu_pd(laneD, bestD);
+        _mm256_storeu_pd(laneI, bestI);
+        for (int l = 0; l < 4; l++)
+            if (laneI[l] >= 0 && (best < 0 || laneD[l] < distanceSq || (laneD[l] == distanceSq && (int)laneI[l] < best)))
+            {
+                distanceSq = laneD[l];
+                best = (int)laneI[l];
+            }
+    }
+    closestIndexScalar(pts, i, end, c, best, distanceSq);
+    return best;
+}
+
+#elif defined(__SSE2__)
+int closestIndex(const PointsSoA &pts, int begin, int end, const Coordinate &c, double &distanceSq)
+{
+    int best = -1;
+    distanceSq = 0;
+    int i = begin;
+    if (end - begin >= 2)
+    {
+        const __m128d cx = _mm_set1_pd(c.x), cy = _mm_set1_pd(c.y), cz = _mm_set1_pd(c.z);
+        const __m128d step = _mm_set1_pd(2);
+        __m128d index = _mm_set_pd(i+1, i);
+        __m128d bestD = _mm_set1_pd(numeric_limits<double>::infinity());
+        __m128d bestI = _mm_set1_pd(-1);
+        for (; i + 2 <= end; i += 2)
+        {
+            __m128d dx = _mm_sub_pd(_mm_loadu_pd(&pts.x[i]), cx);
+            __m128d dy = _mm_sub_pd(_mm_loadu_pd(&pts.y[i]), cy);
+            __m128d dz = _mm_sub_pd(_mm_loadu_pd(&pts.z[i]), cz);
+            __m128d d = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), _mm_mul_pd(dz, dz));
+            __m128d better = _mm_cmplt_pd(d, bestD);
+            bestD = _mm_or_pd(_mm_and_pd(better, d), _mm_andnot_pd(better, bestD));
+            bestI = _mm_or_pd(_mm_and_pd(better, index), _mm_andnot_pd(better, bestI));
+            index = _mm_add_pd(index, step);
+        }
+        double laneD[2], laneI[2];
+        _mm_storeu_pd(laneD, bestD);
+        _mm_storeu_pd(laneI, bestI);
+        for (int l = 0; l < 2; l++)
+            if (laneI[l] >= 0 && (best < 0 || laneD[l] < distanceSq || (laneD[l] == distanceSq && (int)laneI[l] < best)))
+            {
+                distanceSq = laneD[l];
+                best = (int)laneI[l];
+            }
+    }
+    closestIndexScalar(pts, i, end, c, best, distanceSq);
+    return best;
+}
+
+#else
+int closestIndex(const PointsSoA &pts, int begin, int end, const Coordinate &c, double &distanceSq)
+{
+    int best = -1;
+    distanceSq = 0;
+    closestIndexScalar(pts, begin, end, c, best, distanceSq);
+    return best;
+}
+#endif
+
+#endif // POINTSOA_H_INCLUDED
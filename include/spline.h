@@ -0,0 +1,16 @@
+#ifndef SPLINE_H_INCLUDED
+#define SPLINE_H_INCLUDED
+
+// point at t in [0,1] on the uniform Catmull-Rom segment running from p1 to p2
+inline Coordinate catmullRomPoint(const Coordinate &p0, const Coordinate &p1, const Coordinate &p2, const Coordinate &p3, double t)
+{
+    Coordinate v;
+    double t2 = t*t;
+    double t3 = t*t*t;
+    v.x = 0.5 *((2 * p1.x) + (-p0.x + p2.x) * t + (2*p0.x - 5*p1.x + 4*p2.x - p3.x) * t2 + (-p0.x + 3*p1.x- 3*p2.x + p3.x) * t3);
+    v.y = 0.5 *((2 * p1.y) + (-p0.y + p2.y) * t + (2*p0.y - 5*p1.y + 4*p2.y - p3.y) * t2 + (-p0.y + 3*p1.y- 3*p2.y + p3.y) * t3);
+    v.z = 0.5 *((2 * p1.z) + (-p0.z + p2.z) * t + (2*p0.z - 5*p1.z + 4*p2.z - p3.z) * t2 + (-p0.z + 3*p1.z- 3*p2.z + p3.z) * t3);
+    return v;
+}
+
+#endif // SPLINE_H_INCLUDED
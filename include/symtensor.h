@@ -0,0 +1,209 @@
+#ifndef SYMTENSOR_H_INCLUDED
+#define SYMTENSOR_H_INCLUDED
+
+#include <math.h>
+
+// Symmetric 3x3 matrix, the 6 distinct entries only. + and * by a weight let SeparableFilter smooth a
+// grid of them like densities.
+struct SymTensor
+{
+    float xx, xy, xz, yy, yz, zz;
+
+    SymTensor() : xx(0), xy(0), xz(0), yy(0), yz(0), zz(0) {}
+    SymTensor(float xx, float xy, float xz, float yy, float yz, float zz) : xx(xx), xy(xy), xz(xz), yy(yy), yz(yz), zz(zz) {}
+
+    // the outer product of a vector with itself
+    static SymTensor outer(float x, float y, float z) {return SymTensor(x*x, x*y, x*z, y*y, y*z, z*z);}
+
+    inline SymTensor operator+(const SymTensor &o) const {return SymTensor(xx+o.xx, xy+o.xy, xz+o.xz, yy+o.yy, yz+o.yz, zz+o.zz);}
+    inline SymTensor operator*(float w) const {return SymTensor(xx*w, xy*w, xz*w, yy*w, yz*w, zz*w);}
+
+    inline float operator()(int r, int c) const
+    {
+        const float* e[3][3] = {{&xx, &xy, &xz}, {&xy, &yy, &yz}, {&xz, &yz, &zz}};
+        return *e[r][c];
+    }
+};
+
+// Closed form eigen decomposition of a symmetric 3x3 matrix, no iterations and nothing on the heap.
+// Eigenvalues come out largest first, vectors[n] is the unit eigenvector of values[n] and the three
+// are orthonormal, also when eigenvalues repeat. The eigenvalues are the trigonometric solution of the
+// characteristic cubic; each eigenvector is found from the null space of A - value I, the best
+// separated one first and the middle one inside the plane orthogonal to it (D. Eberly, "A Robust
+// Eigensolver for 3x3 Symmetric Matrices"). Everything is done in double and rounded at the end.
+class SymEigen{
+public:
+    float values[3];
+    float vectors[3][3];
+
+    explicit SymEigen(const SymTensor &t)
+    {
+        double a[3][3];
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 3; c++)
+                a[r][c] = t(r, c);
+
+        // scale to avoid overflow and underflow
+        double scale = 0;
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 3; c++)
+                scale = fmax(scale, fabs(a[r][c]));
+
+        double e[3], v[3][3];
+        if (scale == 0)
+        {
+            for (int n = 0; n < 3; n++)
+            {
+                e[n] = 0;
+                for (int c = 0; c < 3; c++)
+                    v[n][c] = n == c;
+            }
+        }
+        else
+        {
+            for (int r = 0; r < 3; r++)
+                for (int c = 0; c < 3; c++)
+                    a[r][c] /= scale;
+            solve(a, e, v);
+            for (int n = 0; n < 3; n++)
+                e[n] *= scale;
+        }
+
+        for (int n = 0; n < 3; n++)
+        {
+            values[n] = e[n];
+            for (int c = 0; c < 3; c++)
+                vectors[n][c] = v[n][c];
+        }
+    }
+
+private:
+    static void solve(const double a[3][3], double e[3], double v[3][3])
+    {
+        double q = (a[0][0] + a[1][1] + a[2][2])/3;
+        double p1 = a[0][1]*a[0][1] + a[0][2]*a[0][2] + a[1][2]*a[1][2];
+        double p2 = (a[0][0]-q)*(a[0][0]-q) + (a[1][1]-q)*(a[1][1]-q) + (a[2][2]-q)*(a[2][2]-q) + 2*p1;
+        double p = sqrt(p2/6);
+
+        if (p == 0)
+        {
+            // a multiple of the identity
+            for (int n = 0; n < 3; n++)
+            {
+                e[n] = q;
+                for (int c = 0; c < 3; c++)
+                    v[n][c] = n == c;
+            }
+            return;
+        }
+
+        double b[3][3];
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 3; c++)
+                b[r][c] = (a[r][c] - (r == c ? q : 0))/p;
+        double halfDet = (b[0][0]*(b[1][1]*b[2][2] - b[1][2]*b[2][1])
+                        - b[0][1]*(b[1][0]*b[2][2] - b[1][2]*b[2][0])
+                        + b[0][2]*(b[1][0]*b[2][1] - b[1][1]*b[2][0]))/2;
+        halfDet = fmin(fmax(halfDet, -1.0), 1.0);
+        double phi = acos(halfDet)/3;
+        const double twoThirdsPi = 2.09439510239319549;
+        e[0] = q + 2*p*cos(phi);
+        e[2] = q + 2*p*cos(phi + twoThirdsPi);
+        e[1] = 3*q - e[0] - e[2];
+
+        // start from the eigenvalue furthest from the middle one
+        int first = e[0] - e[1] >= e[1] - e[2] ? 0 : 2;
+        int last = 2 - first;
+        nullVector(a, e[first], v[first]);
+        nullVectorInPlane(a, e[1], v[first], v[1]);
+        cross(v[first], v[1], v[last]);
+        if (first == 2)     //keep the basis right handed either way
+            for (int c = 0; c < 3; c++)
+                v[last][c] = -v[last][c];
+    }
+
+    static void cross(const double u[3], const double w[3], double out[3])
+    {
+        out[0] = u[1]*w[2] - u[2]*w[1];
+        out[1] = u[2]*w[0] - u[0]*w[2];
+        out[2] = u[0]*w[1] - u[1]*w[0];
+    }
+
+    static double dot(const double u[3], const double w[3]) {return u[0]*w[0] + u[1]*w[1] + u[2]*w[2];}
+
+    // unit vector in the null space of a - value I, from the largest cross product of two of its rows
+    static void nullVector(const double a[3][3], double value, double out[3])
+    {
+        double r[3][3];
+        for (int i = 0; i < 3; i++)
+            for (int c = 0; c < 3; c++)
+                r[i][c] = a[i][c] - (i == c ? value : 0);
+
+        double best[3] = {1, 0, 0}, bestSq = 0;
+        const int pairs[3][2] = {{0, 1}, {0, 2}, {1, 2}};
+        for (int n = 0; n < 3; n++)
+        {
+            double c[3];
+            cross(r[pairs[n][0]], r[pairs[n][1]], c);
+            double sq = dot(c, c);
+            if (sq > bestSq)
+            {
+                bestSq = sq;
+                for (int i = 0; i < 3; i++)
+                    best[i] = c[i];
+            }
+        }
+        double len = bestSq > 0 ? sqrt(bestSq) : 1;
+        for (int i = 0; i < 3; i++)
+            out[i] = best[i]/len;
+    }
+
+    // unit eigenvector of value orthogonal to the unit eigenvector w, from the 2x2 problem in the
+    // plane orthogonal to w
+    static void nullVectorInPlane(const double a[3][3], double value, const double w[3], double out[3])
+    {
+        double u[3], v[3];
+        if (fabs(w[0]) > fabs(w[1]))
+        {
+            double inv = 1/sqrt(w[0]*w[0] + w[2]*w[2]);
+            u[0] = -w[2]*inv; u[1] = 0; u[2] = w[0]*inv;
+        }
+        else
+        {
+            double inv = 1/sqrt(w[1]*w[1] + w[2]*w[2]);
+            u[0] = 0; u[1] = w[2]*inv; u[2] = -w[1]*inv;
+        }
+        cross(w, u, v);
+
+        double au[3], av[3];
+        for (int i = 0; i < 3; i++)
+        {
+            au[i] = a[i][0]*u[0] + a[i][1]*u[1] + a[i][2]*u[2];
+            av[i] = a[i][0]*v[0] + a[i][1]*v[1] + a[i][2]*v[2];
+        }
+        double m00 = dot(u, au) - value, m01 = dot(u, av), m11 = dot(v, av) - value;
+
+        // (x, y) with m (x, y) = 0, taken from the row of m with the larger entries
+        double x = 1, y = 0;
+        if (fabs(m00) >= fabs(m11))
+        {
+            if (fmax(fabs(m00), fabs(m01)) > 0)
+            {
+                double len = sqrt(m00*m00 + m01*m01);
+                x = -m01/len;
+                y = m00/len;
+            }
+        }
+        else if (fmax(fabs(m11), fabs(m01)) > 0)
+        {
+            double len = sqrt(m11*m11 + m01*m01);
+            x = m11/len;
+            y = -m01/len;
+        }
+
+        for (int i = 0; i < 3; i++)
+            out[i] = x*u[i] + y*v[i];
+    }
+};
+
+#endif // SYMTENSOR_H_INCLUDED
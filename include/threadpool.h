@@ -0,0 +1,125 @@
+#ifndef THREADPOOL_H_INCLUDED
+#define THREADPOOL_H_INCLUDED
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+// number of worker threads to use when none is given: one per hardware thread
+int defaultThreadCount()
+{
+    int n = thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+// Fixed set of worker threads, started once and reused by every parallelFor() for the rest of the
+// run. The calling thread works alongside them, so a pool of numThreads starts numThreads-1 threads.
+class ThreadPool{
+public:
+    explicit ThreadPool(int numThreads = defaultThreadCount());
+    ~ThreadPool();
+
+    inline int size() const {return workers.size()+1;}
+
+    // Calls body(0) .. body(count-1) and returns once all of them are done. Indices are handed out
+    // one at a time, so uneven work balances itself. body must be safe to run concurrently for
+    // different indices and must not call back into the pool. Anything that should not depend on
+    // the thread count, like output order, belongs in a serial pass over the per-index results.
+    template <typename Body>
+    void parallelFor(int count, Body body);
+
+private:
+    void run(int count, const function<void(int)> &body);
+    void work();
+    void workerLoop();
+
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake;
+    condition_variable done;
+
+    const function<void(int)>* job;
+    int jobCount;
+    atomic<int> next;
+    int generation;     // bumped for every job, so each worker takes a job exactly once
+    int busy;           // workers that have not finished the current job
+    bool stopping;
+};
+
+ThreadPool::ThreadPool(int numThreads) : job(0), jobCount(0), next(0), generation(0), busy(0), stopping(false)
+{
+    for (int t = 1; t < numThreads; t++)
+        workers.push_back(thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (int t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
+
+template <typename Body>
+void ThreadPool::parallelFor(int count, Body body)
+{
+    if (workers.empty() || count <= 1)
+    {
+        for (int i = 0; i < count; i++)
+            body(i);
+        return;
+    }
+    run(count, function<void(int)>(body));
+}
+
+void ThreadPool::run(int count, const function<void(int)> &body)
+{
+    {
+        lock_guard<mutex> guard(lock);
+        job = &body;
+        jobCount = count;
+        next = 0;
+        busy = workers.size();
+        generation++;
+    }
+    wake.notify_all();
+    work();
+
+    unique_lock<mutex> guard(lock);
+    done.wait(guard, [this]() {return busy == 0;});
+    job = 0;
+}
+
+void ThreadPool::work()
+{
+    for (int i = next++; i < jobCount; i = next++)
+        (*job)(i);
+}
+
+void ThreadPool::workerLoop()
+{
+    int seen = 0;
+    unique_lock<mutex> guard(lock);
+    while (true)
+    {
+        wake.wait(guard, [&]() {return stopping || generation != seen;});
+        if (stopping)
+            return;
+        seen = generation;
+
+        guard.unlock();
+        work();
+        guard.lock();
+        if (--busy == 0)
+            done.notify_one();
+    }
+}
+
+#endif // THREADPOOL_H_INCLUDED
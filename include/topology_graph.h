@@ -2460,7 +2460,7 @@ float getBestPathTrace(vector<vector<Coordinate> > &clusters, short **tracePaths
 	return bestWeight;
 }
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-void findSticksEndsOnSkeleton(Map inSkeleton, vector<vector<Coordinate> >  ssEdges, pair<Coordinate, Coordinate> *ssEnds, string outPath){
+void findSticksEndsOnSkeleton(const Map &inSkeleton, vector<vector<Coordinate> >  ssEdges, pair<Coordinate, Coordinate> *ssEnds, string outPath){
 
 	int i, j, irow, icol, islc, startIndx, endIndx, delta;
 	Coordinate skeletonPnt;
@@ -4012,6 +4012,7 @@ void getShortestTraces(short *nodes, vector<vector<short> >	&adjMtrx, float **li
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /*
  *		find the shortest trace b/w 2 SSends. the only condition is to fit the number of AA in the loop b/w these 2 SSends according to the graph link
+ *		inMRC is taken by value on purpose, the density around the sticks is cleaned from this copy
  */
 void setLoopsWeights_ShortestTrace(vector<vector<cell> > & graph, Map inMRC, vector<vector<Coordinate> > ssEdges, vector<SecondaryStruct>	seqSS, vector<Coordinate> pnts, float peakTHRg, string outPath){
 
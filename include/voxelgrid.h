@@ -0,0 +1,113 @@
+#ifndef VOXELGRID_H_INCLUDED
+#define VOXELGRID_H_INCLUDED
+
+#include <vector>
+
+// Dense 3D grid of voxels in one contiguous buffer, laid out like an MRC file: x (rows) changes
+// fastest, then y (cols), then z (slices). grid[i][j][k] still works as it did for the nested
+// vectors, through small proxy objects, but the cheapest way through the whole grid is a k, j, i
+// loop nest or a single pass over index 0 .. count()-1 (see forEachVoxel).
+template <typename T>
+class VoxelGrid{
+public:
+    // grid[i][j] : the voxels along z for one (x, y)
+    template <typename U>
+    class Line{
+    public:
+        Line(U* base, int stride, int length) : base(base), stride(stride), length(length) {}
+        inline U& operator[](int k) const {return base[k*stride];}
+        inline int size() const {return length;}
+    private:
+        U* base;
+        int stride;
+        int length;
+    };
+
+    // grid[i] : the y-z plane at one x
+    template <typename U>
+    class Plane{
+    public:
+        Plane(U* base, int strideY, int strideZ, int ny, int nz) : base(base), strideY(strideY), strideZ(strideZ), ny(ny), nz(nz) {}
+        inline Line<U> operator[](int j) const {return Line<U>(base + j*strideY, strideZ, nz);}
+        inline int size() const {return ny;}
+    private:
+        U* base;
+        int strideY, strideZ;
+        int ny, nz;
+    };
+
+    VoxelGrid() : nx(0), ny(0), nz(0) {}
+    VoxelGrid(int nx, int ny, int nz, const T &value = T()) : nx(0), ny(0), nz(0) {resize(nx, ny, nz, value);}
+
+    // every voxel is reset to value, nothing is kept from before
+    void resize(int nx, int ny, int nz, const T &value = T())
+    {
+        this->nx = nx;
+        this->ny = ny;
+        this->nz = nz;
+        voxels.assign((size_t)nx*ny*nz, value);
+    }
+    inline void clear() {nx = ny = nz = 0; vector<T>().swap(voxels);}
+    inline void fill(const T &value) {voxels.assign(voxels.size(), value);}
+
+    inline int size() const {return nx;}            // as the nested vectors: number of rows
+    inline int numRows() const {return nx;}
+    inline int numCols() const {return ny;}
+    inline int numSlcs() const {return nz;}
+    inline bool empty() const {return voxels.empty();}
+    inline size_t count() const {return voxels.size();}
+
+    inline int strideY() const {return nx;}
+    inline int strideZ() const {return nx*ny;}
+    inline size_t index(int i, int j, int k) const {return i + (size_t)nx*(j + (size_t)ny*k);}
+    inline void position(size_t n, int &i, int &j, int &k) const
+    {
+        i = n % nx;
+        j = (n / nx) % ny;
+        k = n / ((size_t)nx*ny);
+    }
+    inline bool inside(int i, int j, int k) const {return i >= 0 && j >= 0 && k >= 0 && i < nx && j < ny && k < nz;}
+
+    inline T& operator()(int i, int j, int k) {return voxels[index(i, j, k)];}
+    inline const T& operator()(int i, int j, int k) const {return voxels[index(i, j, k)];}
+
+    inline Plane<T> operator[](int i) {return Plane<T>(voxels.data() + i, strideY(), strideZ(), ny, nz);}
+    inline Plane<const T> operator[](int i) const {return Plane<const T>(voxels.data() + i, strideY(), strideZ(), ny, nz);}
+
+    // linear access in file order, index(i, j, k) == n
+    inline T& at(size_t n) {return voxels[n];}
+    inline const T& at(size_t n) const {return voxels[n];}
+    inline T* data() {return voxels.data();}
+    inline const T* data() const {return voxels.data();}
+    inline typename vector<T>::iterator begin() {return voxels.begin();}
+    inline typename vector<T>::iterator end() {return voxels.end();}
+    inline typename vector<T>::const_iterator begin() const {return voxels.begin();}
+    inline typename vector<T>::const_iterator end() const {return voxels.end();}
+
+private:
+    int nx, ny, nz;
+    vector<T> voxels;
+};
+
+// Calls body(i, j, k, voxel) for every voxel in storage order.
+template <typename T, typename Body>
+void forEachVoxel(VoxelGrid<T> &grid, Body body)
+{
+    T* v = grid.data();
+    for (int k = 0; k < grid.numSlcs(); k++)
+        for (int j = 0; j < grid.numCols(); j++)
+            for (int i = 0; i < grid.numRows(); i++)
+                body(i, j, k, *v++);
+}
+
+template <typename T, typename Body>
+void forEachVoxel(const VoxelGrid<T> &grid, Body body)
+{
+    const T* v = grid.data();
+    for (int k = 0; k < grid.numSlcs(); k++)
+        for (int j = 0; j < grid.numCols(); j++)
+            for (int i = 0; i < grid.numRows(); i++)
+                body(i, j, k, *v++);
+}
+
+#endif // VOXELGRID_H_INCLUDED
@@ -0,0 +1,191 @@
+#ifndef VOXELPIPE_H_INCLUDED
+#define VOXELPIPE_H_INCLUDED
+
+#include <vector>
+#include <math.h>
+#include "voxelgrid.h"
+#include "threadpool.h"
+
+// Calls body(p, lane) for p = 0 .. n-1, 8 at a time in a loop of fixed length, which gcc turns into
+// vector code already at -O2; lane is p % 8 for the full groups and 0 for the rest. Anything body
+// accumulates per lane keeps the lanes independent.
+template <typename Body>
+inline void forEachLane(size_t n, Body body)
+{
+    size_t p = 0;
+    for (; p + 8 <= n; p += 8)
+        for (int l = 0; l < 8; l++)
+            body(p+l, l);
+    for (; p < n; p++)
+        body(p, 0);
+}
+
+// Min, max, mean and rms deviation of a set of densities, gathered a block at a time. The stats of
+// separate parts merge() into the stats of the whole, so every thread can keep its own. NaN voxels
+// count towards the mean but never become a min or max. With bins > 0 a histogram of [lo, hi) is
+// kept as well, voxels outside that range are left out of it.
+struct DensityStats
+{
+    size_t count;
+    float amin;
+    float amax;
+    double sum;
+    double sumOfSquares;
+
+    vector<size_t> histogram;
+    float histLo;
+    float histHi;
+
+    explicit DensityStats(int bins = 0, float lo = 0, float hi = 1);
+
+    inline double mean() const {return count ? sum/count : 0;}
+    inline double rms() const {return count ? sqrt(max(sumOfSquares/count - mean()*mean(), 0.0)) : 0;}     // deviation from the mean
+
+    void add(const float* v, size_t n);
+    void merge(const DensityStats &other);
+};
+
+DensityStats::DensityStats(int bins, float lo, float hi) : count(0), amin(HUGE_VALF), amax(-HUGE_VALF),
+    sum(0), sumOfSquares(0), histogram(max(bins, 0), 0), histLo(lo), histHi(hi)
+{
+}
+
+void DensityStats::add(const float* v, size_t n)
+{
+    //partial results per lane, see forEachLane
+    const int L = 8;
+    float mn[L], mx[L];
+    double s[L], sq[L];
+    for (int l = 0; l < L; l++)
+    {
+        mn[l] = amin;
+        mx[l] = amax;
+        s[l] = sq[l] = 0;
+    }
+
+    //selects rather than branches, so the lanes stay vector code; NaN fails every comparison
+    forEachLane(n, [&](size_t p, int l)
+    {
+        float x = v[p];
+        mn[l] = x < mn[l] ? x : mn[l];
+        mx[l] = x > mx[l] ? x : mx[l];
+        s[l] += x;
+        sq[l] += (double)x*x;
+    });
+
+    for (int l = 0; l < L; l++)
+    {
+        amin = mn[l] < amin ? mn[l] : amin;
+        amax = mx[l] > amax ? mx[l] : amax;
+        sum += s[l];
+        sumOfSquares += sq[l];
+    }
+    count += n;
+
+    if (!histogram.empty())
+    {
+        int bins = histogram.size();
+        float scale = bins/(histHi - histLo);
+        for (size_t p = 0; p < n; p++)
+            if (v[p] >= histLo && v[p] < histHi)
+                histogram[min((int)((v[p] - histLo)*scale), bins-1)]++;
+    }
+}
+
+void DensityStats::merge(const DensityStats &other)
+{
+    count += other.count;
+    amin = min(amin, other.amin);
+    amax = max(amax, other.amax);
+    sum += other.sum;
+    sumOfSquares += other.sumOfSquares;
+    for (int b = 0; b < histogram.size() && b < other.histogram.size(); b++)
+        histogram[b] += other.histogram[b];
+}
+
+// Element-wise steps on densities, applied in the order they were added and fused into one sweep:
+// the voxels are taken a block at a time and every step, then the stats, runs over the block while
+// it is still in cache, so a chain of steps reads and writes the grid once.
+//
+//     DensityStats s = VoxelPipeline().divide(amax).filter(t).run(cube, pool);
+class VoxelPipeline{
+public:
+    VoxelPipeline& divide(float d) {return add(DIVIDE, d);}            //v / d, as Map::normalize
+    VoxelPipeline& scale(float s) {return add(SCALE, s);}              //v * s
+    VoxelPipeline& filter(float threshold) {return add(FILTER, threshold);}     //v below threshold becomes 0, as Map::filterize
+
+    inline bool empty() const {return steps.empty();}
+
+    // the steps over n voxels in place, the result added to stats if there is one
+    void run(float* v, size_t n, DensityStats* stats = 0) const;
+
+    // the whole grid, split between the threads of the pool; returns empty with the stats of the result added
+    DensityStats run(VoxelGrid<float> &grid, ThreadPool &pool, const DensityStats &empty = DensityStats()) const;
+
+private:
+    enum Op {DIVIDE, SCALE, FILTER};
+    struct Step
+    {
+        Op op;
+        float value;
+    };
+
+    VoxelPipeline& add(Op op, float value)
+    {
+        Step s = {op, value};
+        steps.push_back(s);
+        return *this;
+    }
+
+    static const size_t blockSize = 4096;   // voxels, 16 KB of floats
+    vector<Step> steps;
+};
+
+void VoxelPipeline::run(float* v, size_t n, DensityStats* stats) const
+{
+    for (size_t b = 0; b < n; b += blockSize)
+    {
+        float* block = v + b;
+        size_t len = n - b < blockSize ? n - b : blockSize;
+
+        for (int s = 0; s < steps.size(); s++)
+        {
+            float value = steps[s].value;
+            switch (steps[s].op)
+            {
+            case DIVIDE:
+                forEachLane(len, [&](size_t p, int) {block[p] = block[p]/value;});
+                break;
+            case SCALE:
+                forEachLane(len, [&](size_t p, int) {block[p] = block[p]*value;});
+                break;
+            case FILTER:
+                forEachLane(len, [&](size_t p, int) {block[p] = block[p] < value ? 0.0f : block[p];});
+                break;
+            }
+        }
+
+        if (stats)
+            stats->add(block, len);
+    }
+}
+
+DensityStats VoxelPipeline::run(VoxelGrid<float> &grid, ThreadPool &pool, const DensityStats &empty) const
+{
+    size_t n = grid.count();
+    int chunks = pool.size();
+    vector<DensityStats> part(chunks, DensityStats(empty.histogram.size(), empty.histLo, empty.histHi));
+
+    pool.parallelFor(chunks, [&](int c)
+    {
+        size_t from = n*c/chunks, to = n*(c+1)/chunks;
+        run(grid.data() + from, to - from, &part[c]);
+    });
+
+    DensityStats all = empty;
+    for (int c = 0; c < chunks; c++)
+        all.merge(part[c]);
+    return all;
+}
+
+#endif // VOXELPIPE_H_INCLUDED
@@ -0,0 +1,169 @@
+// Checks that a map streamed through MapStream gives the same voxels, gradient and voxel groups as
+// the whole map read into a Map, on a synthetic map written to a temporary file. Build and run:
+//
+//     g++ -std=c++11 -O2 -pthread -I. tests/streamCheck.cpp -o streamcheck && ./streamcheck
+//
+// Prints one line per case and returns 0 when every case matches bit for bit.
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+using namespace std;
+
+#include "../include/protein.h"
+#include "../include/skeleton_overall.h"
+#include "../include/MRC.h"
+#include "../include/components.h"
+#include "../include/mapstream.h"
+
+///a few blobs and tubes of density over a little noise, some of it negative, in an odd sized grid
+void writeSyntheticMap(string fileName)
+{
+    int nx = 37, ny = 29, nz = 43;
+    Map m;
+    m.hdr = MRC_HEADER();
+    m.hdr.nx = m.hdr.mx = nx;
+    m.hdr.ny = m.hdr.my = ny;
+    m.hdr.nz = m.hdr.mz = nz;
+    m.hdr.mode = 2;
+    m.hdr.xlength = nx*1.2f;
+    m.hdr.ylength = ny*1.2f;
+    m.hdr.zlength = nz*1.2f;
+    m.hdr.xorigin = -7.5f;
+    m.hdr.yorigin = 3.25f;
+    m.hdr.zorigin = 0;
+    m.createCube(nx, ny, nz);
+
+    srand(12);
+    double blob[12][4];
+    for (int b = 0; b < 12; b++)
+    {
+        blob[b][0] = rand()%nx;
+        blob[b][1] = rand()%ny;
+        blob[b][2] = rand()%nz;
+        blob[b][3] = 1.5 + (rand()%100)/50.0;   //height
+    }
+    for (int k = 0; k < nz; k++)
+        for (int j = 0; j < ny; j++)
+            for (int i = 0; i < nx; i++)
+            {
+                double v = (rand()%1000)/4000.0 - 0.05;
+                for (int b = 0; b < 12; b++)
+                {
+                    double dSq = pow(i-blob[b][0], 2) + pow(j-blob[b][1], 2) + pow(k-blob[b][2], 2);
+                    v += blob[b][3]*exp(-dSq/16.0);
+                }
+                //a tube along z that crosses every slab
+                v += 2.5*exp(-(pow(i-nx/2, 2) + pow(j-ny/3, 2))/8.0);
+                m.cube(i, j, k) = v;
+            }
+
+    ThreadPool pool(1);
+    DensityStats stats = m.process(VoxelPipeline(), pool);
+    m.hdr.amax = stats.amax;
+    m.hdr.amin = stats.amin;
+    m.hdr.amean = stats.mean();
+    m.hdr.rms = stats.rms();
+    m.write(fileName);
+}
+
+bool sameBits(float a, float b)
+{
+    return memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+///the steps main() takes on a whole map and on a streamed one, compared slab by slab
+bool checkCase(string fileName, int slabDepth, bool smooth, ThreadPool &pool, ostream &report)
+{
+    const int firstGroup = 3;       //groups of earlier chains come first in main()
+
+    Map m;
+    m.read(fileName);
+    m.process(VoxelPipeline().divide(m.hdr.amax).filter(float(.0001/m.hdr.amax)), pool);
+    if (smooth)
+        m.gauss_smooth(pool, SeparableFilter(gaussWeights, 7));
+    double threshold = .72/m.hdr.amax;
+    m.buildGradient(0);
+    DensityStats whole = m.process(VoxelPipeline(), pool);
+
+    VoxelComponents components(threshold);
+    components.add(m.cube);
+    components.finish(2);
+    GroupVoxels mapGroups(components, firstGroup);
+
+    MapStream stream(fileName, slabDepth);
+    stream.normalize();
+    stream.filterize(float(.0001/stream.hdr.amax));
+    double streamThreshold = .72/stream.hdr.amax;
+    if (smooth)
+    {
+        stream.gauss_smooth();
+        stream.forEachSlab(0, [](const MapSlab&) {});
+        streamThreshold = .72/stream.amax;
+    }
+
+    bool same = threshold == streamThreshold;
+    size_t held = 0, grouped = 0;
+    GroupVoxels streamGroups(firstGroup);
+    SlabComponents slabComponents(streamThreshold, [&](const vector<size_t> &voxels) {streamGroups.add(voxels);}, 2);
+    VoxelGrid<Gradient> grad;
+    stream.forEachSlab(1, [&](const MapSlab &slab)
+    {
+        slabGradient(slab, 0, grad);
+        for (int k = slab.k0; k < slab.k1; k++)
+            for (int j = 0; j < slab.ny; j++)
+                for (int i = 0; i < slab.nx; i++)
+                {
+                    const Gradient &g = grad(i, j, k - slab.k0), &h = m.grad(i, j, k);
+                    same = same && sameBits(slab(i, j, k), m.cube(i, j, k)) && sameBits(g.dx, h.dx) &&
+                           sameBits(g.dy, h.dy) && sameBits(g.dz, h.dz) && sameBits(g.da, h.da);
+                }
+        slabComponents.add(slab);
+        held = max(held, slabComponents.voxels.size());
+    });
+    slabComponents.finish();
+    streamGroups.sortByFirstVoxel(firstGroup);
+
+    same = same && stream.amax == whole.amax && stream.amin == whole.amin && stream.amean == float(whole.mean()) && stream.rms == float(whole.rms());
+    same = same && streamGroups.count() == mapGroups.count();
+    for (int g = 0; same && g < mapGroups.count(); g++)
+    {
+        same = streamGroups.size(g) == mapGroups.size(g);
+        for (int n = 0; same && n < mapGroups.size(g); n++)
+            same = streamGroups.voxel(g, n) == mapGroups.voxel(g, n);
+        grouped += mapGroups.size(g);
+    }
+
+    report<<"slabs of "<<setw(2)<<slabDepth<<(smooth ? ", smoothed: " : ":           ")<<(same ? "same" : "DIFFERENT")
+        <<"  ("<<mapGroups.count()-firstGroup<<" groups of "<<grouped<<" voxels, at most "<<held<<" voxels held while streaming)"<<endl;
+    return same;
+}
+
+int main()
+{
+    string fileName = "streamCheck.mrc";
+    writeSyntheticMap(fileName);
+
+    //the Map functions tell what they are doing on cout, only the results are shown
+    ThreadPool pool;
+    stringstream quiet, report;
+    streambuf* console = cout.rdbuf(quiet.rdbuf());
+    bool ok = true;
+    int depths[] = {1, 2, 5, 16, 64};
+    for (int s = 0; s < 2; s++)
+        for (int d = 0; d < 5; d++)
+            ok = checkCase(fileName, depths[d], s == 1, pool, report) && ok;
+    cout.rdbuf(console);
+
+    cout<<report.str();
+    remove(fileName.c_str());
+    cout<<(ok ? "streamed map matches the whole map" : "streamed map DIFFERS from the whole map")<<endl;
+    return ok ? 0 : 1;
+}